@@ -0,0 +1,156 @@
+#pragma once
+
+#include "common.h"
+#include "subset.h"
+
+// Library interface of the commands: one call per command, taking a context, the hair and an options struct,
+// and returning its results in memory. Nothing is read from or written to globals, so calls with different
+// contexts may run concurrently from different threads (calls that modify the hair in place need their own hair too).
+// Invalid options are reported by throwing std::runtime_error.
+namespace api {
+
+// Settings and log shared by the calls of one caller
+struct Context {
+    unsigned int num_threads = 0;       // Number of threads for per-strand work (all hardware threads if 0)
+    unsigned int seed = 0;              // Key of the per-strand random number generators (Philox4x32)
+    nlohmann::json log;                 // Messages logged during the calls, by level ("debug", "info", "warn", ...)
+    std::vector<double> thread_busy_time;   // Seconds spent on work by each pool thread during the calls
+};
+
+// Make ctx the context of the calling thread (and of the pool threads working for it) for the lifetime of this object
+class ContextScope {
+public:
+    explicit ContextScope(Context& ctx);
+    ~ContextScope();
+    ContextScope(const ContextScope&) = delete;
+    ContextScope& operator=(const ContextScope&) = delete;
+private:
+    Context* prev;
+};
+
+// Remove duplicated points and degenerate strands, in place; returns false (leaving the hair untouched) if there is nothing to fix
+bool autofix(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile);
+
+struct DecomposeOptions {
+    std::set<int> indices;              // Strands to extract (all strands if empty)
+};
+// One single-strand subset per extracted strand, in increasing strand index
+std::vector<HairSubset> decompose(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const DecomposeOptions& options);
+
+struct FilterOptions {
+    std::string key;                    // Per-strand value to filter by, see `hairutil filter --help`
+    std::optional<float> lt;
+    std::optional<float> gt;
+    std::optional<float> leq;
+    std::optional<float> geq;
+};
+struct FilterResult {
+    std::vector<unsigned int> indices;  // Selected strands in increasing order
+    HairSubset subset;                  // View of the selected strands
+};
+FilterResult filter(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const FilterOptions& options);
+
+struct FindpenetOptions {
+    std::string mesh_path;
+    float decimate_ratio = 0.25f;
+    float threshold_ratio = 0.3f;       // A strand penetrates if more than this ratio of its points is inside the mesh
+};
+// Indices of the strands penetrating the mesh, in increasing order
+std::vector<unsigned int> findpenet(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const FindpenetOptions& options);
+
+struct GetcurvatureOptions {
+    float angle_threshold = 0.01f;      // Turning angle (in degrees) below which a point is considered straight
+};
+struct StrandCurvature {
+    bool straight = false;
+    Eigen::VectorXf edge_length;
+    Eigen::MatrixX3f binormal;
+    std::vector<float> kappa;
+    std::vector<float> tau;
+};
+std::vector<StrandCurvature> getcurvature(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const GetcurvatureOptions& options);
+
+struct ResampleOptions {
+    float target_segment_length = 0;    // 0 uses the per-strand average segment length
+    bool linear_subdiv = false;
+    bool catmull_rom = false;
+    float cr_power = 0.5f;
+    bool c2_interp = false;
+};
+std::shared_ptr<cyHairFile> resample(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const ResampleOptions& options);
+
+struct SmoothOptions {
+    float lambda = 1.0f;
+};
+// Smooths the hair in place and returns it
+std::shared_ptr<cyHairFile> smooth(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const SmoothOptions& options);
+
+struct StrandInfo {
+    size_t idx = 0;
+    unsigned int nsegs = 0;
+    float length = 0;
+    float turning_angle_sum = 0;
+    float max_segment_length = 0;
+    float min_segment_length = std::numeric_limits<float>::max();
+    float max_segment_turning_angle_diff = 0;
+    float min_segment_turning_angle_diff = std::numeric_limits<float>::max();
+    float max_point_circumradius_reciprocal = 0;
+    float min_point_circumradius_reciprocal = std::numeric_limits<float>::max();
+    float max_point_turning_angle = 0;
+    float min_point_turning_angle = std::numeric_limits<float>::max();
+    float max_point_curvature = 0;
+    float min_point_curvature = std::numeric_limits<float>::max();
+};
+struct SegmentInfo {
+    size_t idx = 0;
+    unsigned int strand_idx = 0;
+    unsigned int local_idx = 0;         // Index of the segment within the strand
+    float length = 0;
+    float turning_angle_diff = 0;
+};
+struct PointInfo {
+    size_t idx = 0;                   // Index of the center point into the global points array
+    unsigned int strand_idx = 0;
+    unsigned int local_idx = 0;             // Index of the center point within the strand points
+    float circumradius_reciprocal = 0;      // Reciprocal of the circumradius of the wedge triangle formed by the point and its two neighbors
+    float turning_angle = 0;
+    float curvature = 0;                    // Discrete curvature (turning_angle_rad / segment_length_average)
+};
+struct StatsResult {
+    std::vector<StrandInfo> strands;
+    std::vector<SegmentInfo> segments;
+    std::vector<PointInfo> points;          // Interior points only
+};
+StatsResult stats(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile);
+
+struct SubsampleOptions {
+    unsigned int target_count = 0;      // Number of strands picked by Poisson disk sampling of the roots, if indices is empty
+    float scale_factor = 0.9f;          // Factor for scaling down the Poisson disk radius
+    std::set<int> indices;              // Strands to extract
+    bool exclude = false;               // Extract all strands but indices
+};
+struct SubsampleResult {
+    std::vector<unsigned int> indices;  // Selected strands in increasing order
+    HairSubset subset;                  // View of the selected strands
+};
+SubsampleResult subsample(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const SubsampleOptions& options);
+
+struct TransformOptions {
+    Eigen::Matrix4f M = Eigen::Matrix4f::Identity();
+};
+// Transforms the hair in place and returns it
+std::shared_ptr<cyHairFile> transform(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const TransformOptions& options);
+
+struct TubifyOptions {
+    float radius = 0;
+    unsigned int num_sides = 6;
+    bool capped = false;
+};
+struct TubifyResult {
+    std::vector<std::array<double, 3>> vertex_xyz;
+    std::vector<std::array<double, 3>> vertex_rgb;
+    std::vector<std::vector<uint32_t>> faces;
+};
+TubifyResult tubify(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const TubifyOptions& options);
+
+}
@@ -1,4 +1,4 @@
-#include "common.h"
+#include "api.h"
 
 namespace cmd {
 
@@ -13,6 +13,7 @@ void filter(args::Subparser &parser);
 void findpenet(args::Subparser &parser);
 void getcurvature(args::Subparser &parser);
 void info(args::Subparser &parser);
+void pipe(args::Subparser &parser);
 void resample(args::Subparser &parser);
 void smooth(args::Subparser &parser);
 void stats(args::Subparser &parser);
@@ -22,15 +23,31 @@ void tubify(args::Subparser &parser);
 }
 
 namespace param {
-    inline bool& b(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, bool>> m; return m[cmd_][param_]; }
-    inline unsigned int& ui(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, unsigned int>> m; return m[cmd_][param_]; }
-    inline float& f(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, float>> m; return m[cmd_][param_]; }
-    inline std::string& s(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, std::string>> m; return m[cmd_][param_]; }
-    inline std::set<int>& set_i(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, std::set<int>>> m; return m[cmd_][param_]; }
-    inline std::optional<float>& opt_f(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, std::optional<float>>> m; return m[cmd_][param_]; }
-    inline Eigen::Matrix4f& mat4f(const std::string& cmd_, const std::string& param_) { static std::unordered_map<std::string, std::unordered_map<std::string, Eigen::Matrix4f>> m; return m[cmd_][param_]; }
+    inline bool& b(const std::string& cmd_, const std::string& param_) { return globals::state().param_b[cmd_][param_]; }
+    inline unsigned int& ui(const std::string& cmd_, const std::string& param_) { return globals::state().param_ui[cmd_][param_]; }
+    inline float& f(const std::string& cmd_, const std::string& param_) { return globals::state().param_f[cmd_][param_]; }
+    inline std::string& s(const std::string& cmd_, const std::string& param_) { return globals::state().param_s[cmd_][param_]; }
+    inline std::set<int>& set_i(const std::string& cmd_, const std::string& param_) { return globals::state().param_set_i[cmd_][param_]; }
+    inline std::optional<float>& opt_f(const std::string& cmd_, const std::string& param_) { return globals::state().param_opt_f[cmd_][param_]; }
+    inline Eigen::Matrix4f& mat4f(const std::string& cmd_, const std::string& param_) { return globals::state().param_mat4f[cmd_][param_]; }
 }
 
+// Context of the library calls made by a command, with --threads and --seed from the command line.
+// While alive, it also collects the messages logged by the command itself, and hands the whole log over to globals::json["log"] when destroyed.
+class CliContext : public api::Context {
+public:
+    CliContext();
+    ~CliContext();
+private:
+    api::ContextScope scope;
+};
+
+// Make the selected strands the output of the command, to be saved from their base hair (see globals::output_subset)
+void set_output_subset(HairSubset subset);
+
+// Drop the head meshes findpenet keeps for the files of a batch
+void clear_mesh_cache();
+
 namespace exec {
 std::shared_ptr<cyHairFile> autofix(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> convert(std::shared_ptr<cyHairFile> hairfile_in);
@@ -39,6 +56,7 @@ std::shared_ptr<cyHairFile> filter(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> findpenet(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> getcurvature(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> info(std::shared_ptr<cyHairFile> hairfile_in);
+std::shared_ptr<cyHairFile> pipe(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> resample(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> smooth(std::shared_ptr<cyHairFile> hairfile_in);
 std::shared_ptr<cyHairFile> stats(std::shared_ptr<cyHairFile> hairfile_in);
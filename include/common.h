@@ -16,6 +16,7 @@
 #include <random>
 #include <optional>
 #include <numbers>
+#include <mutex>
 
 #include <args.hxx>
 #include <spdlog/spdlog.h>
@@ -30,26 +31,88 @@
 #include "output_file.h"
 #include "random.h"
 
+namespace api { struct Context; }
+struct HairSubset;
+
 namespace globals {
     extern const float pi;
     extern const float pi_2;
 
-    // Given as command line arguments
-    extern std::string input_file;
-    extern std::set<std::string> output_exts;
-    extern bool overwrite;
-    extern unsigned int ply_load_default_nsegs;
-    extern bool ply_save_ascii;
-
-    extern std::string input_file_wo_ext;
-    extern std::string input_ext;
-    extern OutputFile output_file_wo_ext;        // For lazy evaluation
-    extern std::string output_dir;
-    extern std::function<void(void)> check_error;
-    extern std::shared_ptr<cyHairFile> (*cmd_exec)(std::shared_ptr<cyHairFile>);
-    extern std::mt19937 rng;
+    // State of one invocation (command line arguments, command parameters, log), shared by the whole process
+    // except for threads that call use_thread_state(), so that batch mode can process several files concurrently
+    struct State {
+        // Given as command line arguments
+        std::string input_file;
+        std::set<std::string> output_exts;
+        bool overwrite = false;
+        unsigned int ply_load_default_nsegs = 0;
+        bool ply_save_ascii = false;
+        bool ply_save_minimal = false;      // Leave out the edge element, and the vertex colors if the hair has none
+        float hzc_error = 1e-4f;            // Maximum absolute error of the values in saved HZC files (0 for lossless)
+        unsigned int hzc_deflate_level = 6; // zlib level of the chunks of saved HZC files (0 for no compression)
+        std::vector<std::pair<unsigned int, unsigned int>> strands;     // Strands to load, as sorted disjoint ranges [begin, end) (empty for all)
+        unsigned int num_threads = 0;
+
+        std::string input_file_wo_ext;
+        std::string input_ext;
+        OutputFile output_file_wo_ext;        // For lazy evaluation
+        std::string output_dir;
+        std::function<void(void)> check_error;
+        std::shared_ptr<cyHairFile> (*cmd_exec)(std::shared_ptr<cyHairFile>) = nullptr;
+        std::shared_ptr<const HairSubset> output_subset;    // Set by commands selecting strands instead of returning a hair, to save them without a copy
+        unsigned int seed = 0;              // Key of the per-strand random number generators (Philox4x32)
+        nlohmann::json json;
+        std::vector<double> thread_busy_time;   // Seconds spent on work by each pool thread
+
+        // Command parameters, see cmd::param
+        std::unordered_map<std::string, std::unordered_map<std::string, bool>> param_b;
+        std::unordered_map<std::string, std::unordered_map<std::string, unsigned int>> param_ui;
+        std::unordered_map<std::string, std::unordered_map<std::string, float>> param_f;
+        std::unordered_map<std::string, std::unordered_map<std::string, std::string>> param_s;
+        std::unordered_map<std::string, std::unordered_map<std::string, std::set<int>>> param_set_i;
+        std::unordered_map<std::string, std::unordered_map<std::string, std::optional<float>>> param_opt_f;
+        std::unordered_map<std::string, std::unordered_map<std::string, Eigen::Matrix4f>> param_mat4f;
+    };
+
+    // State used by the calling thread
+    State& state();
+
+    // Give the calling thread a state of its own, which must outlive the thread's use of globals.
+    // Must be called before the thread touches any of the variables below, as they are bound on first use.
+    // Parallel regions started from such a thread run serially, since the pool threads use the process state.
+    void use_thread_state(State& state);
+    bool has_thread_state();
+
+    // Members of the calling thread's state
+    extern thread_local std::string& input_file;
+    extern thread_local std::set<std::string>& output_exts;
+    extern thread_local bool& overwrite;
+    extern thread_local unsigned int& ply_load_default_nsegs;
+    extern thread_local bool& ply_save_ascii;
+    extern thread_local bool& ply_save_minimal;
+    extern thread_local float& hzc_error;
+    extern thread_local unsigned int& hzc_deflate_level;
+    extern thread_local std::vector<std::pair<unsigned int, unsigned int>>& strands;
+    extern thread_local unsigned int& num_threads;
+
+    extern thread_local std::string& input_file_wo_ext;
+    extern thread_local std::string& input_ext;
+    extern thread_local OutputFile& output_file_wo_ext;
+    extern thread_local std::string& output_dir;
+    extern thread_local std::function<void(void)>& check_error;
+    extern thread_local decltype(State::cmd_exec)& cmd_exec;
+    extern thread_local std::shared_ptr<const HairSubset>& output_subset;
+    extern thread_local unsigned int& seed;
+    extern thread_local nlohmann::json& json;
+    extern thread_local std::vector<double>& thread_busy_time;
+
     extern const char* const VERSIONTAG;
-    extern nlohmann::json json;
+    extern std::mutex log_mutex;            // Guards json logging from parallel regions
+    extern std::mutex hdf5_mutex;           // Held around all HDF5 calls, as the bundled HDF5 is not built thread-safe (batch mode)
+    extern thread_local api::Context* context;      // Context of the library call running on this thread, see api::ContextScope
+
+    // Where log messages go: the log of the current context if any, else json["log"]
+    nlohmann::json& log_json();
 
     void clear();
 }
@@ -59,30 +122,35 @@ using std::endl;
 
 template <typename... Args>
 inline void log_debug(spdlog::format_string_t<Args...> fmt, Args &&...args) {
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
     spdlog::debug(fmt, std::forward<Args>(args)...);
-    globals::json["log"]["debug"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
+    globals::log_json()["debug"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
 }
 
 template <typename... Args>
 inline void log_info(spdlog::format_string_t<Args...> fmt, Args &&...args) {
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
     spdlog::info(fmt, std::forward<Args>(args)...);
-    globals::json["log"]["info"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
+    globals::log_json()["info"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
 }
 
 template <typename... Args>
 inline void log_warn(spdlog::format_string_t<Args...> fmt, Args &&...args) {
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
     spdlog::warn(fmt, std::forward<Args>(args)...);
-    globals::json["log"]["warn"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
+    globals::log_json()["warn"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
 }
 
 template <typename... Args>
 inline void log_error(spdlog::format_string_t<Args...> fmt, Args &&...args) {
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
     spdlog::error(fmt, std::forward<Args>(args)...);
-    globals::json["log"]["error"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
+    globals::log_json()["error"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
 }
 
 template <typename... Args>
 inline void log_critical(spdlog::format_string_t<Args...> fmt, Args &&...args) {
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
     spdlog::critical(fmt, std::forward<Args>(args)...);
-    globals::json["log"]["critical"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
+    globals::log_json()["critical"].push_back(fmt::format(fmt, std::forward<Args>(args)...));
 }
@@ -41,6 +41,10 @@
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 //-------------------------------------------------------------------------------
 
@@ -103,6 +107,26 @@ public:
 	float          const * GetTransparencyArray() const { return transparency; }	//!< Returns transparency array (transparency at each hair point).
 	float          const * GetColorsArray      () const { return colors; }			//!< Returns colors array (rgb color at each hair point).
 
+	//! Returns the index of the first point of each hair strand, with one extra trailing entry equal to the total number of points,
+	//! so that strand i has points [offsets[i], offsets[i+1]). (Added for hairutil)
+	//! Built on the first call and cached until the strand layout changes through SetHairCount, SetArrays, SetDefaultSegmentCount,
+	//! Initialize or LoadFromFile. Code writing the segments array directly must do so before the first call.
+	//! Safe to call concurrently, but not concurrently with the methods above that change the layout.
+	std::vector<unsigned int> const & GetOffsetsArray() const
+	{
+		if ( offsets_ready.load( std::memory_order_acquire ) ) return offsets;
+		std::lock_guard<std::mutex> lock( offsets_mutex );
+		if ( !offsets_ready.load( std::memory_order_relaxed ) ) {
+			offsets.resize( header.hair_count + 1 );
+			offsets[0] = 0;
+			for ( unsigned int i=0; i<header.hair_count; i++ ) {
+				offsets[i+1] = offsets[i] + ( segments ? segments[i] : header.d_segments ) + 1;
+			}
+			offsets_ready.store( true, std::memory_order_release );
+		}
+		return offsets;
+	}
+
 
 	//////////////////////////////////////////////////////////////////////////
 	//!@name Data Access Methods
@@ -120,11 +144,17 @@ public:
 	//! Deletes all arrays and initializes the header data.
 	void Initialize()
 	{
+		ClearOffsets();
+		if ( storage ) {	// External arrays are not ours to delete
+			segments = nullptr; points = nullptr; thickness = nullptr; transparency = nullptr; colors = nullptr;
+			storage.reset();
+		}
 		if ( segments ) delete [] segments;
 		if ( points ) delete [] points;
 		if ( colors ) delete [] colors;
 		if ( thickness ) delete [] thickness;
 		if ( transparency ) delete [] transparency;
+		segments = nullptr; points = nullptr; thickness = nullptr; transparency = nullptr; colors = nullptr;
 		header.signature[0] = 'H';
 		header.signature[1] = 'A';
 		header.signature[2] = 'I';
@@ -144,7 +174,9 @@ public:
 	//! Sets the hair count, re-allocates segments array if necessary.
 	void SetHairCount( int count )
 	{
+		DetachArrays();
 		header.hair_count = count;
+		ClearOffsets();
 		if ( segments ) {
 			delete [] segments;
 			segments = new unsigned short[ header.hair_count ];
@@ -154,6 +186,7 @@ public:
 	// Sets the point count, re-allocates points, thickness, transparency, and colors arrays if necessary.
 	void SetPointCount( int count )
 	{
+		DetachArrays();
 		header.point_count = count;
 		if ( points ) {
 			delete [] points;
@@ -178,7 +211,9 @@ public:
 	//! Note that a valid HAIR file should always have points array.
 	void SetArrays( int array_types )
 	{
+		DetachArrays();
 		header.arrays = array_types;
+		ClearOffsets();
 		if (  (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT    ) && !segments     ) { segments = new unsigned short[header.hair_count]; }
 		if ( !(header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT    ) &&  segments     ) { delete [] segments; segments=nullptr; }
 		if (  (header.arrays & _CY_HAIR_FILE_POINTS_BIT      ) && !points       ) { points = new float[header.point_count*3]; }
@@ -191,8 +226,31 @@ public:
 		if ( !(header.arrays & _CY_HAIR_FILE_COLORS_BIT      ) &&  colors       ) { delete [] colors; colors=nullptr; }
 	}
 
+	//! Makes the arrays point into memory kept alive by storage (e.g. a copy-on-write memory mapping of a HAIR file) instead of
+	//! arrays of their own, with the given header. The arrays are copied into arrays of their own by the methods above before they
+	//! change any array size, and are released with storage otherwise. (Added for hairutil)
+	void SetExternalArrays( Header const &h, std::shared_ptr<void> s, unsigned short *seg, float *pts, float *thk, float *trn, float *col )
+	{
+		Initialize();
+		header = h;
+		storage = std::move( s );
+		segments = seg; points = pts; thickness = thk; transparency = trn; colors = col;
+	}
+
+	//! Returns true if the arrays point into external memory set by SetExternalArrays. (Added for hairutil)
+	bool HasExternalArrays() const { return storage != nullptr; }
+
+	//! Lowers the hair and point counts without re-allocating the arrays, e.g. after compacting the strands to their front
+	//! in place. The arrays keep their size, of which only the first strands and points are used. (Added for hairutil)
+	void ShrinkCounts( int hair_count, int point_count )
+	{
+		header.hair_count = hair_count;
+		header.point_count = point_count;
+		ClearOffsets();
+	}
+
 	//! Sets default number of segments for all hair strands, which is used if segments array does not exist.
-	void SetDefaultSegmentCount( int s ) { header.d_segments = s; }
+	void SetDefaultSegmentCount( int s ) { header.d_segments = s; ClearOffsets(); }
 
 	//! Sets default hair strand thickness, which is used if thickness array does not exist.
 	void SetDefaultThickness( float t ) { header.d_thickness = t; }
@@ -218,6 +276,7 @@ public:
 
 		// read the header
 		size_t headread = fread( &header, sizeof(Header), 1, fp );
+		ClearOffsets();
 
 		#define _CY_FAILED_RETURN(errorno) { Initialize(); fclose( fp ); return errorno; }
 
@@ -373,6 +432,32 @@ private:
 	float			*transparency;
 	float			*colors;
 
+	mutable std::vector<unsigned int>	offsets;				// Cache of GetOffsetsArray
+	mutable std::atomic<bool>			offsets_ready = false;
+	mutable std::mutex					offsets_mutex;
+
+	void ClearOffsets() { offsets_ready.store( false, std::memory_order_relaxed ); offsets.clear(); }
+
+	std::shared_ptr<void>				storage;				// Owner of the arrays if set by SetExternalArrays
+
+	// Copy the arrays set by SetExternalArrays into arrays of their own
+	void DetachArrays()
+	{
+		if ( !storage ) return;
+		auto detach = [](auto *&array, size_t count) {
+			if ( !array ) return;
+			auto *copy = new std::remove_reference_t<decltype(*array)>[ count ];
+			memcpy( copy, array, count * sizeof(*array) );
+			array = copy;
+		};
+		detach( segments, header.hair_count );
+		detach( points, header.point_count*3 );
+		detach( thickness, header.point_count );
+		detach( transparency, header.point_count );
+		detach( colors, header.point_count*3 );
+		storage.reset();
+	}
+
 	// Given point before (p0) and after (p2), computes the direction (d) at p1.
 	float ComputeDirection( float *d, float &d0len, float &d1len, float const *p0, float const *p1, float const *p2 )
 	{
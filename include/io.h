@@ -1,12 +1,16 @@
 #pragma once
 
 #include "common.h"
+#include "subset.h"
 
 namespace io {
 
 using load_func_t = std::function<std::shared_ptr<cyHairFile>(const std::string &filename)>;
 using save_func_t = std::function<void(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile)>;
 
+// Strands to load, as half-open ranges [begin, end) of strand indices
+using strand_ranges_t = std::vector<std::pair<unsigned int, unsigned int>>;
+
 std::shared_ptr<cyHairFile> load_bin(const std::string &filename);
 std::shared_ptr<cyHairFile> load_hair(const std::string &filename);
 std::shared_ptr<cyHairFile> load_data(const std::string &filename);
@@ -14,6 +18,8 @@ std::shared_ptr<cyHairFile> load_ply(const std::string &filename);
 std::shared_ptr<cyHairFile> load_ma(const std::string &filename);
 std::shared_ptr<cyHairFile> load_abc(const std::string &filename);
 std::shared_ptr<cyHairFile> load_npy(const std::string &filename);
+std::shared_ptr<cyHairFile> load_hzc(const std::string &filename);
+std::shared_ptr<cyHairFile> load_h5(const std::string &filename);
 
 void save_bin(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
 void save_hair(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
@@ -22,6 +28,45 @@ void save_ply(const std::string &filename, const std::shared_ptr<cyHairFile> &ha
 void save_ma(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
 void save_abc(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
 void save_npy(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
+void save_hzc(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
+void save_h5(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile);
+
+// Loaders reading only the data of the strands in ranges (after the strand headers for .bin and .data files),
+// which make a hair of these strands in the order of the ranges
+std::shared_ptr<cyHairFile> load_bin_subset(const std::string &filename, const strand_ranges_t &ranges);
+std::shared_ptr<cyHairFile> load_hair_subset(const std::string &filename, const strand_ranges_t &ranges);
+std::shared_ptr<cyHairFile> load_data_subset(const std::string &filename, const strand_ranges_t &ranges);
+std::shared_ptr<cyHairFile> load_npy_subset(const std::string &filename, const strand_ranges_t &ranges);
+std::shared_ptr<cyHairFile> load_hzc_subset(const std::string &filename, const strand_ranges_t &ranges);
+std::shared_ptr<cyHairFile> load_h5_subset(const std::string &filename, const strand_ranges_t &ranges);
+
+// Load the strands in ranges from a file in the format given by ext, loading the whole file for formats without a subset loader
+std::shared_ptr<cyHairFile> load_subset(const std::string &filename, const std::string &ext, const strand_ranges_t &ranges);
+
+// Throw if ranges are not within [0, hair_count)
+void check_strand_ranges(const strand_ranges_t &ranges, unsigned int hair_count, const std::string &filename);
+
+// Writers saving the strands of a subset straight from its base hair
+void save_bin_subset(const std::string &filename, const HairSubset &subset);
+void save_hair_subset(const std::string &filename, const HairSubset &subset);
+void save_data_subset(const std::string &filename, const HairSubset &subset);
+
+// Per-point array of hair given by its _CY_HAIR_FILE_*_BIT (points, thickness, transparency or colors)
+template <class Hair>
+auto get_array(Hair& hairfile, unsigned int bit) {
+    switch (bit) {
+        case _CY_HAIR_FILE_POINTS_BIT: return hairfile.GetPointsArray();
+        case _CY_HAIR_FILE_THICKNESS_BIT: return hairfile.GetThicknessArray();
+        case _CY_HAIR_FILE_TRANSPARENCY_BIT: return hairfile.GetTransparencyArray();
+        default: return hairfile.GetColorsArray();
+    }
+}
+
+// Save a subset in the format given by ext, through HairSubset::materialize() for formats without a subset writer
+void save_subset(const std::string &filename, const std::string &ext, const HairSubset &subset);
+
+// Name of the strand offsets file going with the .npy points file filename, written when strands have different numbers of segments
+std::string npy_offsets_filename(const std::string &filename);
 
 }
 
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Read-only memory mapping of a whole file, so that loaders can parse it in place (and in parallel) without reading it into a buffer first
+class MappedFile {
+public:
+    // With copy_on_write, the mapping can also be written through mutable_data(): written pages are copied privately,
+    // leaving the file unchanged
+    explicit MappedFile(const std::string& filename, bool copy_on_write = false);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    char* mutable_data() { return data_; }      // Only for mappings made with copy_on_write
+    size_t size() const { return size_; }
+
+    // Copy of the value of type T at byte offset pos (which need not be aligned); throws if it runs past the end of the file
+    template <class T>
+    T read(size_t pos) const {
+        T value;
+        read(pos, sizeof(T), &value);
+        return value;
+    }
+
+    // Copy count bytes at byte offset pos into dst; throws if they run past the end of the file
+    void read(size_t pos, size_t count, void* dst) const {
+        check_range(pos, count);
+        std::memcpy(dst, data_ + pos, count);
+    }
+
+    // Throw if [pos, pos + count) runs past the end of the file
+    void check_range(size_t pos, size_t count) const;
+
+private:
+    std::string filename;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Shared writable memory mapping of a new file of a given size, preallocated on disk, so that writers of formats whose
+// layout is known up front can fill disjoint parts of it from several threads. The mapping is of a temporary file next
+// to filename, which replaces filename on commit() and is removed if the object is destroyed without it.
+class MappedOutputFile {
+public:
+    MappedOutputFile(const std::string& filename, size_t size);
+    ~MappedOutputFile();
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    char* data() { return data_; }
+    size_t size() const { return size_; }
+
+    // Write the mapping back to disk and move the file to filename; throws on I/O errors
+    void commit();
+
+private:
+    std::string filename;
+    std::string temp_filename;
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    bool committed = false;
+};
+
+// File read with pread at given positions, for loaders that only need a few parts of a large file.
+// Reads can be made from several threads at once.
+class RandomAccessFile {
+public:
+    explicit RandomAccessFile(const std::string& filename);
+    ~RandomAccessFile();
+    RandomAccessFile(const RandomAccessFile&) = delete;
+    RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+    size_t size() const { return size_; }
+
+    // Read count bytes at byte offset pos into dst; throws if they run past the end of the file
+    void read(size_t pos, size_t count, void* dst) const;
+
+    template <class T>
+    T read(size_t pos) const {
+        T value;
+        read(pos, sizeof(T), &value);
+        return value;
+    }
+
+private:
+    std::string filename;
+    int fd = -1;
+    size_t size_ = 0;
+};
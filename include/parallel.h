@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+namespace parallel {
+
+// Number of threads used for parallel regions (num_threads of the current api::Context if any, else globals::num_threads;
+// all hardware threads if 0)
+unsigned int num_threads();
+
+// Call func(begin, end) on disjoint subranges covering [0, n), distributed over the thread pool.
+// Blocks until all subranges are processed; the first exception thrown by func is rethrown.
+// Calls made from inside a parallel region, from a thread with its own globals::State, or while the pool is busy with
+// another thread's region, run serially on the calling thread.
+// Idle threads steal subranges from busy ones; time spent in func is added to the thread_busy_time of the current api::Context if any,
+// else to globals::thread_busy_time of the calling thread.
+void for_range(size_t n, const std::function<void(size_t, size_t)>& func);
+
+// Same as above for items of uneven cost, where item i costs cost_offsets[i+1] - cost_offsets[i]
+// (cost_offsets has n + 1 entries); subranges are cut to roughly equal total cost rather than item count
+void for_range(const std::vector<unsigned int>& cost_offsets, const std::function<void(size_t, size_t)>& func);
+
+// Call func(i, offset, nsegs) for every strand i, distributed over the thread pool with strands weighted by
+// their number of points, so that a few long strands do not leave the other threads idle.
+// The first form takes the strand offsets, e.g. those of a Strands; the second one uses the offsets cached on the hair.
+template <class Func>
+inline void for_each_strand(const std::vector<unsigned int>& offsets, Func func) {
+    for_range(offsets, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            func((unsigned int)i, offsets[i], offsets[i + 1] - offsets[i] - 1);
+    });
+}
+template <class Func>
+inline void for_each_strand(const cyHairFile& hairfile, Func func) {
+    for_each_strand(hairfile.GetOffsetsArray(), func);
+}
+
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <limits>
+
 template <typename T>
 class UniformIntDistribution {
 public:
@@ -21,3 +25,59 @@ private:
     T a_;
     T b_;
 };
+
+// Counter-based random number generator (Philox4x32-10 by Salmon et al., SC'11), keyed by a seed and a stream index.
+// Every (seed, stream) pair gives an independent sequence, so per-strand random values can be drawn by
+// using the strand index as the stream, regardless of the order (or thread) in which strands are processed.
+// Draws made for the hair as a whole use hair_stream, which lies outside the range of strand indices.
+class Philox4x32 {
+public:
+    using result_type = uint32_t;
+
+    static constexpr uint64_t hair_stream = std::numeric_limits<uint64_t>::max();
+
+    Philox4x32(uint64_t seed, uint64_t stream) :
+        key_{ uint32_t(seed), uint32_t(seed >> 32) },
+        counter_{ 0, 0, uint32_t(stream), uint32_t(stream >> 32) } {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT32_MAX; }
+
+    result_type operator()() {
+        if (idx_ == 4) {
+            generate();
+            idx_ = 0;
+        }
+        return output_[idx_++];
+    }
+
+private:
+    void generate() {
+        std::array<uint32_t, 4> ctr = counter_;
+        std::array<uint32_t, 2> key = key_;
+        for (int r = 0; r < 10; ++r) {
+            if (r > 0) {
+                key[0] += 0x9E3779B9;
+                key[1] += 0xBB67AE85;
+            }
+            const uint64_t prod0 = uint64_t(0xD2511F53) * ctr[0];
+            const uint64_t prod1 = uint64_t(0xCD9E8D57) * ctr[2];
+            ctr = {
+                uint32_t(prod1 >> 32) ^ ctr[1] ^ key[0],
+                uint32_t(prod1),
+                uint32_t(prod0 >> 32) ^ ctr[3] ^ key[1],
+                uint32_t(prod0)
+            };
+        }
+        output_ = ctr;
+
+        // Advance the 64-bit block counter held in the lower two words
+        if (++counter_[0] == 0)
+            ++counter_[1];
+    }
+
+    std::array<uint32_t, 2> key_;
+    std::array<uint32_t, 4> counter_;
+    std::array<uint32_t, 4> output_ = {};
+    int idx_ = 4;
+};
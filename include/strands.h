@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+
+#include <new>
+
+// Allocator aligning buffers to Alignment bytes (a cache line by default), so that kernels can use aligned vector loads
+template <class T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template <class U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+};
+
+template <class T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+// Hair in structure-of-arrays layout: every coordinate and attribute in its own aligned buffer indexed by global point index,
+// and the point offset of every strand. Kernels can then run over contiguous floats instead of strided xyz triplets.
+// Converted from/to cyHairFile at the boundary of the commands that use it.
+struct Strands {
+    aligned_vector<float> x, y, z;
+    aligned_vector<float> thickness;                // Empty if the hair has no thickness array
+    aligned_vector<float> transparency;             // Empty if the hair has no transparency array
+    aligned_vector<float> r, g, b;                  // Empty if the hair has no colors array
+    std::vector<unsigned int> offsets = { 0 };      // Point offset of every strand, with one extra trailing entry equal to the point count
+
+    float default_thickness = 1.0f;
+    float default_transparency = 0.0f;
+    std::array<float, 3> default_color = { 1.0f, 1.0f, 1.0f };
+
+    Strands() = default;
+    // Kernels that only need the geometry can leave the attribute buffers empty
+    explicit Strands(const cyHairFile& hairfile, bool with_attributes = true);
+
+    unsigned int hair_count() const { return offsets.size() - 1; }
+    unsigned int point_count() const { return offsets.back(); }
+    unsigned int nsegs(unsigned int i) const { return offsets[i + 1] - offsets[i] - 1; }
+
+    std::shared_ptr<cyHairFile> to_hairfile() const;
+
+    // Write the coordinates back into hairfile, which must have the same points as the one this was made from
+    void copy_points_to(cyHairFile& hairfile) const;
+
+    // Length of the segment from every point to the next one in its strand (0 at the last point of a strand)
+    aligned_vector<float> segment_lengths() const;
+
+    // Geometry of the wedge formed by every point and its two neighbors (0 at the first and last points of a strand)
+    struct Wedges {
+        aligned_vector<float> circumradius_reciprocal;
+        aligned_vector<float> turning_angle;        // In degrees
+        aligned_vector<float> curvature;            // turning_angle (in radians) / average length of the two segments
+    };
+    Wedges wedges(const aligned_vector<float>& segment_lengths) const;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+
+// Non-owning view of some strands of a hair: the base hair and the indices of the selected strands, in increasing order.
+// Writers can save it straight from the base hair (see io::save_subset), so that commands selecting strands
+// do not copy their points just to write a file; materialize() makes the copy when a hair is needed.
+struct HairSubset {
+    std::shared_ptr<cyHairFile> base;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> offsets = { 0 };  // Point offset of every selected strand within the subset, with one extra trailing entry equal to the point count
+    bool uniform_segments = false;              // The selected strands have the same number of segments, given as the default segment count instead of a segments array
+
+    HairSubset() = default;
+    HairSubset(std::shared_ptr<cyHairFile> base, std::vector<unsigned int> indices);
+    HairSubset(std::shared_ptr<cyHairFile> base, const std::vector<unsigned char>& selected);
+    // All strands of the hair
+    explicit HairSubset(std::shared_ptr<cyHairFile> base);
+
+    unsigned int hair_count() const { return indices.size(); }
+    unsigned int point_count() const { return offsets.back(); }
+    bool empty() const { return indices.empty(); }
+
+    // Point offset of selected strand k within the base hair
+    unsigned int base_offset(unsigned int k) const { return base->GetOffsetsArray()[indices[k]]; }
+    unsigned int num_points(unsigned int k) const { return offsets[k + 1] - offsets[k]; }
+
+    // Header of the hair made of the selected strands
+    cyHairFile::Header header() const;
+
+    // Copy the selected strands into a hair of their own
+    std::shared_ptr<cyHairFile> materialize() const;
+};
@@ -2,7 +2,18 @@
 
 namespace util {
 
-std::shared_ptr<cyHairFile> get_subset(std::shared_ptr<cyHairFile> hairfile_in, const std::vector<unsigned char>& selected);
+// Whether str matches pattern containing wildcards '*' (any sequence) and '?' (any character)
+bool match_wildcard(const std::string& str, const std::string& pattern);
+
+// Whether the input file is a .txt list of input files or a wildcard pattern, i.e., for batch mode
+bool is_batch_input(const std::string& input_file);
+
+// Input files listed in a .txt file (one per line, relative to the list file, '#' for comments) or matched by a wildcard pattern in the file name
+std::vector<std::string> list_batch_input_files(const std::string& input_file);
+
+// Strand ranges [begin, end) from a comma-separated list of indices and inclusive ranges, e.g., "1000-2000,5000",
+// sorted and merged
+std::vector<std::pair<unsigned int, unsigned int>> parse_strand_ranges(const std::string& str);
 
 template <typename T>
 struct StatsInfo {
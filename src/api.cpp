@@ -0,0 +1,36 @@
+#include "api.h"
+#include "cmd.h"
+
+api::ContextScope::ContextScope(Context& ctx) : prev(globals::context) {
+    globals::context = &ctx;
+}
+
+api::ContextScope::~ContextScope() {
+    globals::context = prev;
+}
+
+cmd::CliContext::CliContext() : scope(*this) {
+    num_threads = globals::num_threads;
+    seed = globals::seed;
+    thread_busy_time = std::exchange(globals::thread_busy_time, {});
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
+    if (globals::json.contains("log")) {
+        log = std::move(globals::json["log"]);
+        globals::json.erase("log");
+    }
+}
+
+cmd::CliContext::~CliContext() {
+    globals::thread_busy_time = std::move(thread_busy_time);
+    std::lock_guard<std::mutex> lock(globals::log_mutex);
+    if (!log.is_null())
+        globals::json["log"] = std::move(log);
+}
+
+void cmd::set_output_subset(HairSubset subset) {
+    if (subset.empty()) {
+        log_warn("No strand is selected");
+        return;
+    }
+    globals::output_subset = std::make_shared<const HairSubset>(std::move(subset));
+}
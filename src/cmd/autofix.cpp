@@ -1,4 +1,7 @@
 #include "cmd.h"
+#include "parallel.h"
+
+#include <atomic>
 
 using namespace Eigen;
 
@@ -9,114 +12,129 @@ void cmd::parse::autofix(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::autofix(std::shared_ptr<cyHairFile> hairfile_in) {
-    const auto& header_in = hairfile_in->GetHeader();
+    CliContext ctx;
+    return api::autofix(ctx, hairfile_in) ? hairfile_in : nullptr;
+}
 
-    const bool has_segments = hairfile_in->GetSegmentsArray() != nullptr;
-    const bool has_thickness = hairfile_in->GetThicknessArray() != nullptr;
-    const bool has_transparency = hairfile_in->GetTransparencyArray() != nullptr;
-    const bool has_color = hairfile_in->GetColorsArray() != nullptr;
+bool api::autofix(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile) {
+    const ContextScope scope(ctx);
+    const cyHairFile::Header header_in = hairfile->GetHeader();
 
-    const unsigned int in_hair_count = header_in.hair_count;
-    const unsigned int in_point_count = header_in.point_count;
+    const bool has_segments = hairfile->GetSegmentsArray() != nullptr;
+    const bool has_thickness = hairfile->GetThicknessArray() != nullptr;
+    const bool has_transparency = hairfile->GetTransparencyArray() != nullptr;
+    const bool has_color = hairfile->GetColorsArray() != nullptr;
 
-    std::vector<unsigned short> out_segments;   out_segments.reserve(in_hair_count);
-    std::vector<float> out_points;              out_points.reserve(in_point_count * 3);
-    std::vector<float> out_thickness;           out_thickness.reserve(in_point_count);
-    std::vector<float> out_transparency;        out_transparency.reserve(in_point_count);
-    std::vector<float> out_color;               out_color.reserve(in_point_count * 3);
+    const unsigned int in_hair_count = header_in.hair_count;
+    const std::vector<unsigned int>& in_offsets = hairfile->GetOffsetsArray();      // Stays valid until the counts are shrunk at the end
+
+    float* points = hairfile->GetPointsArray();
+    const auto is_duplicated = [points](unsigned int point_idx) {
+        return std::equal(points + 3*point_idx, points + 3*(point_idx + 1), points + 3*(point_idx - 1));
+    };
+
+    // Fast check for clean input: look for zero-segment strands, and for points equal to their predecessor over whole
+    // point ranges with a branchless loop (strand boundaries included, so a hit only means the strands need a closer look)
+    std::atomic<bool> maybe_dirty = false;
+    parallel::for_range(in_offsets, [&](size_t begin, size_t end) {
+        unsigned int num_hits = 0;
+        for (size_t i = begin; i < end; ++i)
+            num_hits += in_offsets[i + 1] - in_offsets[i] == 1;
+        for (size_t k = std::max<size_t>(in_offsets[begin], 1); k < in_offsets[end]; ++k)
+            num_hits += (points[3*k] == points[3*k - 3]) & (points[3*k + 1] == points[3*k - 2]) & (points[3*k + 2] == points[3*k - 1]);
+        if (num_hits)
+            maybe_dirty = true;
+    });
+    if (!maybe_dirty)
+        return false;
+
+    // Count the points surviving in each strand, 0 if the strand is removed altogether
+    std::vector<unsigned int> out_num_points(in_hair_count, 0);
+    parallel::for_range(in_offsets, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const unsigned int num_segments = in_offsets[i + 1] - in_offsets[i] - 1;
+            if (num_segments == 0)
+                continue;
+            unsigned int num_points = 1;
+            for (unsigned int j = 1; j <= num_segments; ++j) {
+                if (!is_duplicated(in_offsets[i] + j))
+                    ++num_points;
+            }
+            out_num_points[i] = num_points > 1 ? num_points : 0;
+        }
+    });
 
+    // Report issues in strand order
     bool fixed = false;
-
     unsigned int total_num_err_segments = 0;
-    unsigned int out_hair_count = 0;
-    unsigned int offset = 0;
     for (unsigned int i = 0; i < in_hair_count; ++i) {
-        const unsigned int num_segments = has_segments ? hairfile_in->GetSegmentsArray()[i] : header_in.d_segments;
+        const unsigned int num_segments = in_offsets[i + 1] - in_offsets[i] - 1;
+        if (out_num_points[i] == num_segments + 1)
+            continue;
+        fixed = true;
 
         if (num_segments == 0) {
             log_warn("Strand {} has no segments, removed", i);
-            fixed = true;
-            offset += 1;
             continue;
         }
-
-        int num_err_segments = 0;
-
-        Vector3f prev_point;
-        for (unsigned int j = 0; j <= num_segments; ++j) {
-            const Vector3f point = Map<Vector3f>(hairfile_in->GetPointsArray() + 3*(offset + j));
-
-            if (j > 0 && prev_point == point) {
+        for (unsigned int j = 1; j <= num_segments; ++j) {
+            if (is_duplicated(in_offsets[i] + j)) {
                 log_warn("Strand {} has duplicated point at segment {}, removed", i, j);
-                fixed = true;
-                ++num_err_segments;
-                continue;
-            }
-            prev_point = point;
-
-            for (unsigned int k = 0; k < 3; ++k) {
-                out_points.push_back(hairfile_in->GetPointsArray()[3*(offset + j) + k]);
-                if (has_color) {
-                    out_color.push_back(hairfile_in->GetColorsArray()[3*(offset + j) + k]);
-                }
-            }
-            if (has_thickness) {
-                out_thickness.push_back(hairfile_in->GetThicknessArray()[offset + j]);
-            }
-            if (has_transparency) {
-                out_transparency.push_back(hairfile_in->GetTransparencyArray()[offset + j]);
+                ++total_num_err_segments;
             }
         }
-
-        if (num_segments > num_err_segments) {
-            out_segments.push_back(num_segments - num_err_segments);
-            ++out_hair_count;
-        } else {
+        if (out_num_points[i] == 0)
             log_warn("All the segments in strand {} are degenerate, removed", i);
-
-            // Remove the first point, as the strand is skipped
-            for (int k = 0; k < 3; ++k) {
-                out_points.pop_back();
-                if (has_color) out_color.pop_back();
-                if (has_thickness) out_thickness.pop_back();
-                if (has_transparency) out_transparency.pop_back();
-            }
-        }
-
-        total_num_err_segments += num_err_segments;
-        offset += num_segments + 1;
     }
 
-    // If no issue is found, return nullptr
+    // The hits of the fast check were all at strand boundaries
     if (!fixed)
-        return {};
-
-    // Create output hair file
-    std::shared_ptr<cyHairFile> hairfile_out = std::make_shared<cyHairFile>();
-
-    // Copy header via memcpy
-    std::memcpy((void*)&hairfile_out->GetHeader(), &header_in, sizeof(cyHairFile::Header));
-
-    // Set hair_count & point_count, allocate arrays
-    hairfile_out->SetHairCount(out_hair_count);
-    hairfile_out->SetPointCount(out_points.size() / 3);
-    hairfile_out->SetArrays(header_in.arrays);
+        return false;
+
+    // Compact the surviving strands and points towards the front of the arrays, in place.
+    // Every output index is at most the input index being read, so a single forward pass never overwrites unread data;
+    // the previous point of a strand is kept aside since its slot may have been overwritten.
+    float* thickness = hairfile->GetThicknessArray();
+    float* transparency = hairfile->GetTransparencyArray();
+    float* colors = hairfile->GetColorsArray();
+    unsigned int out_hair_count = 0;
+    unsigned int out_idx = 0;
+    for (unsigned int i = 0; i < in_hair_count; ++i) {
+        if (out_num_points[i] == 0)
+            continue;
+        if (has_segments)
+            hairfile->GetSegmentsArray()[out_hair_count] = out_num_points[i] - 1;
+        ++out_hair_count;
+
+        std::array<float, 3> prev_point;
+        for (unsigned int in_idx = in_offsets[i]; in_idx < in_offsets[i + 1]; ++in_idx) {
+            const std::array<float, 3> point = { points[3*in_idx], points[3*in_idx + 1], points[3*in_idx + 2] };
+            const bool duplicated = in_idx > in_offsets[i] && point == prev_point;
+            prev_point = point;
+            if (duplicated)
+                continue;
 
-    if (total_num_err_segments > 0) {
-        hairfile_out->SetArrays(header_in.arrays | _CY_HAIR_FILE_SEGMENTS_BIT);
-        hairfile_out->SetDefaultSegmentCount(0);
+            std::copy_n(point.data(), 3, points + 3*out_idx);
+            if (has_thickness) thickness[out_idx] = thickness[in_idx];
+            if (has_transparency) transparency[out_idx] = transparency[in_idx];
+            if (has_color) std::copy_n(colors + 3*in_idx, 3, colors + 3*out_idx);
+            ++out_idx;
+        }
     }
 
-    // Copy data to arrays of hairfile_out
-    std::memcpy(hairfile_out->GetPointsArray(), out_points.data(), out_points.size() * sizeof(float));
-
-    if (has_segments || total_num_err_segments > 0) {
-        std::memcpy(hairfile_out->GetSegmentsArray(), out_segments.data(), out_segments.size() * sizeof(unsigned short));
+    // Shrink the counts only, leaving the arrays allocated at their original size
+    hairfile->ShrinkCounts(out_hair_count, out_idx);
+
+    // Strands of different lengths now need a segments array
+    if (!has_segments && total_num_err_segments > 0) {
+        hairfile->SetArrays(header_in.arrays | _CY_HAIR_FILE_SEGMENTS_BIT);
+        hairfile->SetDefaultSegmentCount(0);
+        unsigned int out_hair_idx = 0;
+        for (unsigned int i = 0; i < in_hair_count; ++i) {
+            if (out_num_points[i] > 0)
+                hairfile->GetSegmentsArray()[out_hair_idx++] = out_num_points[i] - 1;
+        }
     }
 
-    if (has_thickness) std::memcpy(hairfile_out->GetThicknessArray(), out_thickness.data(), out_thickness.size() * sizeof(float));
-    if (has_transparency) std::memcpy(hairfile_out->GetTransparencyArray(), out_transparency.data(), out_transparency.size() * sizeof(float));
-    if (has_color) std::memcpy(hairfile_out->GetColorsArray(), out_color.data(), out_color.size() * sizeof(float));
-
-    return hairfile_out;
+    return true;
 }
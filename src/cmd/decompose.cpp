@@ -3,7 +3,7 @@
 #include "util.h"
 
 namespace {
-struct {
+thread_local struct {
     bool& confirm = cmd::param::b("decompose", "confirm");
     std::set<int>& indices = cmd::param::set_i("decompose", "indices");
 } param;
@@ -45,42 +45,11 @@ std::shared_ptr<cyHairFile> cmd::exec::decompose(std::shared_ptr<cyHairFile> hai
         std::filesystem::create_directory(output_dirs[output_ext]);
     }
 
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < header.hair_count; ++i) {
-        const unsigned int segment_count = (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT) ? hairfile_in->GetSegmentsArray()[i] : header.d_segments;
+    CliContext ctx;
+    const std::vector<HairSubset> subsets = api::decompose(ctx, hairfile_in, { .indices = ::param.indices });
 
-        if (!::param.indices.empty() && !::param.indices.count(i)) {
-            offset += segment_count + 1;
-            continue;
-        }
-
-        auto hairfile_out = std::make_shared<cyHairFile>();
-
-        hairfile_out->SetHairCount(1);
-
-        // Figure out number of points on this strand
-        hairfile_out->SetPointCount(segment_count + 1);
-        hairfile_out->SetDefaultSegmentCount(segment_count);
-
-        // Allocate array
-        hairfile_out->SetArrays(header.arrays & (31 - _CY_HAIR_FILE_SEGMENTS_BIT));
-
-        // Copy values
-        for (unsigned int j = 0; j <= segment_count; ++j) {
-            for (unsigned int k = 0; k < 3; ++k) {
-                hairfile_out->GetPointsArray()[3*j + k] = hairfile_in->GetPointsArray()[3*(offset+j) + k];
-
-                if (header.arrays & _CY_HAIR_FILE_COLORS_BIT)
-                    hairfile_out->GetColorsArray()[3*j + k] = hairfile_in->GetColorsArray()[3*(offset+j) + k];
-            }
-
-            if (header.arrays & _CY_HAIR_FILE_THICKNESS_BIT) hairfile_out->GetThicknessArray()[j] = hairfile_in->GetThicknessArray()[offset + j];
-            if (header.arrays & _CY_HAIR_FILE_TRANSPARENCY_BIT) hairfile_out->GetTransparencyArray()[j] = hairfile_in->GetTransparencyArray()[offset + j];
-        }
-
-        if (!(header.arrays & _CY_HAIR_FILE_THICKNESS_BIT)) hairfile_out->SetDefaultThickness(header.d_thickness);
-        if (!(header.arrays & _CY_HAIR_FILE_TRANSPARENCY_BIT)) hairfile_out->SetDefaultTransparency(header.d_transparency);
-        if (!(header.arrays & _CY_HAIR_FILE_COLORS_BIT)) hairfile_out->SetDefaultColor(header.d_color[0], header.d_color[1], header.d_color[2]);
+    for (const HairSubset& subset : subsets) {
+        const unsigned int i = subset.indices[0];
 
         // Save
         for (const auto& [output_ext, output_dir] : output_dirs) {
@@ -88,11 +57,35 @@ std::shared_ptr<cyHairFile> cmd::exec::decompose(std::shared_ptr<cyHairFile> hai
             if (header.hair_count < 1000 || (i > 0 && i % 1000 == 0) || !::param.indices.empty()) {
                 log_info("Saving to {} ...", output_file);
             }
-            globals::supported_ext.at(output_ext).second(output_file, hairfile_out);
+            io::save_subset(output_file, output_ext, subset);
         }
-
-        offset += segment_count + 1;
     }
 
     return {};
 }
+
+std::vector<HairSubset> api::decompose(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in, const DecomposeOptions& options) {
+    const ContextScope scope(ctx);
+    const cyHairFile::Header &header = hairfile_in->GetHeader();
+
+    // Strands to extract
+    std::vector<unsigned int> indices;
+    if (options.indices.empty()) {
+        indices.resize(header.hair_count);
+        std::iota(indices.begin(), indices.end(), 0);
+    } else {
+        for (const int i : options.indices) {
+            if (i >= 0 && i < header.hair_count)
+                indices.push_back(i);
+        }
+    }
+
+    std::vector<HairSubset> subsets;
+    subsets.reserve(indices.size());
+    for (const unsigned int i : indices) {
+        // Single strands are saved with their segment count as the default one, without a segments array
+        subsets.emplace_back(hairfile_in, std::vector<unsigned int>{ i });
+        subsets.back().uniform_segments = true;
+    }
+    return subsets;
+}
@@ -1,11 +1,13 @@
 #include "cmd.h"
+#include "parallel.h"
+#include "strands.h"
 #include "util.h"
 
 using namespace Eigen;
 
 namespace {
 
-struct {
+thread_local struct {
     std::string& key = cmd::param::s("filter", "key");
     std::optional<float>& lt = cmd::param::opt_f("filter", "lt");
     std::optional<float>& gt = cmd::param::opt_f("filter", "gt");
@@ -93,15 +95,64 @@ void cmd::parse::filter(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::filter(std::shared_ptr<cyHairFile> hairfile_in) {
+    CliContext ctx;
+    api::FilterResult result = api::filter(ctx, hairfile_in, {
+        .key = ::param.key,
+        .lt = ::param.lt,
+        .gt = ::param.gt,
+        .leq = ::param.leq,
+        .geq = ::param.geq
+    });
+    globals::json["filter"]["num_selected_strands"] = result.indices.size();
+    if (::param.output_indices) {
+        std::string suffix;
+        if (::param.gt) suffix += fmt::format("_gt_{}", *::param.gt);
+        if (::param.geq) suffix += fmt::format("_geq_{}", *::param.geq);
+        if (::param.lt) suffix += fmt::format("_lt_{}", *::param.lt);
+        if (::param.leq) suffix += fmt::format("_leq_{}", *::param.leq);
+        std::string indices_file = util::path_under_optional_dir(fmt::format("{}_filtered_{}{}_indices.txt", globals::input_file_wo_ext, ::param.key, suffix), globals::output_dir);
+        if (!globals::overwrite && std::filesystem::exists(indices_file)) {
+            throw std::runtime_error("File already exists: " + indices_file + ". Use --overwrite to overwrite.");
+        }
+        std::ofstream ofs(indices_file);
+        if (!ofs) {
+            throw std::runtime_error(fmt::format("Failed to open file: {}", indices_file));
+        }
+        for (unsigned int i : result.indices) {
+            ofs << i << "\n";
+        }
+        log_info("Selected strand indices written to {}", indices_file);
+        globals::json["filter"]["indices_file"] = indices_file;
+    }
+
+    if (!::param.no_output)
+        cmd::set_output_subset(std::move(result.subset));
+    return {};
+}
+
+api::FilterResult api::filter(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in, const FilterOptions& options) {
+    const ContextScope scope(ctx);
+    if (::keys_set.count(options.key) == 0) {
+        throw std::runtime_error(fmt::format("Invalid key: {}", options.key));
+    }
+    if (options.lt && options.leq) {
+        throw std::runtime_error("Cannot specify both lt and leq");
+    }
+    if (options.gt && options.geq) {
+        throw std::runtime_error("Cannot specify both gt and geq");
+    }
+
     const auto& header_in = hairfile_in->GetHeader();
 
+    // Per-segment and per-point geometry computed over the whole SoA buffers, then reduced per strand
+    const Strands strands(*hairfile_in, false);
+    const aligned_vector<float> segment_lengths = strands.segment_lengths();
+    const Strands::Wedges wedges = strands.wedges(segment_lengths);
+
     // Flag for whether a strand is selected
     std::vector<unsigned char> selected(header_in.hair_count, 0);
 
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < header_in.hair_count; ++i) {
-        const unsigned int nsegs = header_in.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? hairfile_in->GetSegmentsArray()[i] : header_in.d_segments;
-
+    parallel::for_each_strand(strands.offsets, [&](unsigned int i, unsigned int offset, unsigned int nsegs) {
         float strand_length = 0.0f;
         float turning_angle_sum = 0.0f;
         float max_segment_length = 0.0f;
@@ -115,27 +166,18 @@ std::shared_ptr<cyHairFile> cmd::exec::filter(std::shared_ptr<cyHairFile> hairfi
         float max_point_curvature = 0.0f;
         float min_point_curvature = std::numeric_limits<float>::max();
 
-        Vector3f prev_point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * offset);
         float prev_turning_angle;
         for (unsigned int j = 0; j < nsegs; ++j) {
-            const Vector3f point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * (offset + j + 1));
-            const float segment_length = (point - prev_point).norm();
+            const float segment_length = segment_lengths[offset + j];
 
             max_segment_length = std::max(max_segment_length, segment_length);
             min_segment_length = std::min(min_segment_length, segment_length);
 
             if (j < nsegs - 1) {
-                // Compute the circumradius of the wedge triangle
-                const Vector3f next_point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * (offset + j + 2));
-                const float la = (point - prev_point).norm();
-                const float lb = (next_point - point).norm();
-                const float lc = (next_point - prev_point).norm();
-                const float s = (la + lb + lc) / 2.0f;
-                const float A = std::sqrt(s * (s - la) * (s - lb) * (s - lc));
-                const float circumradius_reciprocal = A > 0.0f ? 1.0f / (la * lb * lc / (4.0f * A)) : 0.0f;
-                const float turning_angle_rad = globals::pi - std::acos(std::clamp((la * la + lb * lb - lc * lc) / (2.0f * la * lb), -1.0f, 1.0f));
-                const float turning_angle = turning_angle_rad * 180.0f / globals::pi;
-                const float curvature = turning_angle_rad / ((la + lb) / 2.0f);
+                // Wedge at the end point of the segment
+                const float circumradius_reciprocal = wedges.circumradius_reciprocal[offset + j + 1];
+                const float turning_angle = wedges.turning_angle[offset + j + 1];
+                const float curvature = wedges.curvature[offset + j + 1];
 
                 max_point_circumradius_reciprocal = std::max(max_point_circumradius_reciprocal, circumradius_reciprocal);
                 min_point_circumradius_reciprocal = std::min(min_point_circumradius_reciprocal, circumradius_reciprocal);
@@ -155,59 +197,37 @@ std::shared_ptr<cyHairFile> cmd::exec::filter(std::shared_ptr<cyHairFile> hairfi
             }
 
             strand_length += segment_length;
-            prev_point = point;
         }
 
-        offset += nsegs + 1;
-
         double value;
-        if (::param.key == "length") value = strand_length;
-        if (::param.key == "nsegs") value = nsegs;
-        if (::param.key == "tasum") value = turning_angle_sum;
-        if (::param.key == "maxseglength") value = max_segment_length;
-        if (::param.key == "minseglength") value = min_segment_length;
-        if (::param.key == "maxsegtadiff") value = max_segment_turning_angle_difference;
-        if (::param.key == "minsegtadiff") value = min_segment_turning_angle_difference;
-        if (::param.key == "maxptcrr") value = max_point_circumradius_reciprocal;
-        if (::param.key == "minptcrr") value = min_point_circumradius_reciprocal;
-        if (::param.key == "maxptta") value = max_point_turning_angle;
-        if (::param.key == "minptta") value = min_point_turning_angle;
-        if (::param.key == "maxptcurv") value = max_point_curvature;
-        if (::param.key == "minptcurv") value = min_point_curvature;
-
-        if (::param.lt && value >= *::param.lt) continue;
-        if (::param.gt && value <= *::param.gt) continue;
-        if (::param.leq && value > *::param.leq) continue;
-        if (::param.geq && value < *::param.geq) continue;
+        if (options.key == "length") value = strand_length;
+        if (options.key == "nsegs") value = nsegs;
+        if (options.key == "tasum") value = turning_angle_sum;
+        if (options.key == "maxseglength") value = max_segment_length;
+        if (options.key == "minseglength") value = min_segment_length;
+        if (options.key == "maxsegtadiff") value = max_segment_turning_angle_difference;
+        if (options.key == "minsegtadiff") value = min_segment_turning_angle_difference;
+        if (options.key == "maxptcrr") value = max_point_circumradius_reciprocal;
+        if (options.key == "minptcrr") value = min_point_circumradius_reciprocal;
+        if (options.key == "maxptta") value = max_point_turning_angle;
+        if (options.key == "minptta") value = min_point_turning_angle;
+        if (options.key == "maxptcurv") value = max_point_curvature;
+        if (options.key == "minptcurv") value = min_point_curvature;
+
+        if (options.lt && value >= *options.lt) return;
+        if (options.gt && value <= *options.gt) return;
+        if (options.leq && value > *options.leq) return;
+        if (options.geq && value < *options.geq) return;
 
         selected[i] = 1;
-    }
-    log_info("{} strands selected", std::count(selected.begin(), selected.end(), 1));
-    globals::json["filter"]["num_selected_strands"] = std::count(selected.begin(), selected.end(), 1);
-    if (::param.output_indices) {
-        std::string suffix;
-        if (::param.gt) suffix += fmt::format("_gt_{}", *::param.gt);
-        if (::param.geq) suffix += fmt::format("_geq_{}", *::param.geq);
-        if (::param.lt) suffix += fmt::format("_lt_{}", *::param.lt);
-        if (::param.leq) suffix += fmt::format("_leq_{}", *::param.leq);
-        std::string indices_file = util::path_under_optional_dir(fmt::format("{}_filtered_{}{}_indices.txt", globals::input_file_wo_ext, ::param.key, suffix), globals::output_dir);
-        if (!globals::overwrite && std::filesystem::exists(indices_file)) {
-            throw std::runtime_error("File already exists: " + indices_file + ". Use --overwrite to overwrite.");
-        }
-        std::ofstream ofs(indices_file);
-        if (!ofs) {
-            throw std::runtime_error(fmt::format("Failed to open file: {}", indices_file));
-        }
-        for (unsigned int i = 0; i < selected.size(); ++i) {
-            if (selected[i]) {
-                ofs << i << "\n";
-            }
-        }
-        log_info("Selected strand indices written to {}", indices_file);
-        globals::json["filter"]["indices_file"] = indices_file;
-    }
+    });
 
-    if (::param.no_output)
-        return {};
-    return util::get_subset(hairfile_in, selected);
+    FilterResult result;
+    for (unsigned int i = 0; i < header_in.hair_count; ++i) {
+        if (selected[i])
+            result.indices.push_back(i);
+    }
+    log_info("{} strands selected", result.indices.size());
+    result.subset = HairSubset(hairfile_in, result.indices);
+    return result;
 }
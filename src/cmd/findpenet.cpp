@@ -1,20 +1,96 @@
 #include "cmd.h"
+#include "parallel.h"
 #include "util.h"
 
 #include <igl/read_triangle_mesh.h>
 #include <igl/fast_winding_number.h>
 #include <igl/decimate.h>
 
+#include <future>
+
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
 std::string& mesh_path = cmd::param::s("findpenet", "mesh_path");
 float& decimate_ratio = cmd::param::f("findpenet", "decimate_ratio");
 float& threshold_ratio = cmd::param::f("findpenet", "threshold_ratio");
 bool& no_export = cmd::param::b("findpenet", "no_export");
 bool& no_print = cmd::param::b("findpenet", "no_print");
 } param;
+
+// Decimated head mesh with its winding number BVH
+struct Mesh {
+    MatrixXd V;
+    MatrixXi F;
+    igl::FastWindingNumberBVH fwn_bvh;
+};
+
+// Meshes cached by (path, modification time, decimate ratio) so that files of a batch share them, until cmd::clear_mesh_cache().
+// A mesh is built outside the lock, threads asking for it meanwhile waiting on its future.
+using MeshKey = std::tuple<std::string, std::filesystem::file_time_type, float>;
+std::mutex mesh_cache_mutex;
+std::map<MeshKey, std::shared_future<std::shared_ptr<const Mesh>>> mesh_cache;
+
+std::shared_ptr<const Mesh> read_mesh(const std::string& mesh_path, float decimate_ratio) {
+    // Read triangle mesh
+    log_info("Reading triangle mesh from {}", mesh_path);
+    MatrixXd OV;
+    MatrixXi OF;
+    if (!igl::read_triangle_mesh(mesh_path, OV, OF)) {
+        throw std::runtime_error("Failed to read triangle mesh");
+    }
+
+    auto mesh_new = std::make_shared<Mesh>();
+
+    // Decimate triangle mesh
+    if (decimate_ratio < 1.0f) {
+        log_info("Decimating triangle mesh with ratio {} ({} faces)", decimate_ratio, (int)(decimate_ratio * OF.rows()));
+        VectorXi J, I;
+        igl::decimate(OV, OF, decimate_ratio * OF.rows(), false, mesh_new->V, mesh_new->F, J, I);
+    } else {
+        mesh_new->V = OV;
+        mesh_new->F = OF;
+    }
+
+    igl::fast_winding_number(mesh_new->V, mesh_new->F, 2, mesh_new->fwn_bvh);
+    return mesh_new;
+}
+
+std::shared_ptr<const Mesh> load_mesh(const std::string& mesh_path, float decimate_ratio) {
+    std::error_code ec;
+    const MeshKey key = { mesh_path, std::filesystem::last_write_time(mesh_path, ec), decimate_ratio };
+
+    std::promise<std::shared_ptr<const Mesh>> promise;
+    std::shared_future<std::shared_ptr<const Mesh>> cached;
+    {
+        std::lock_guard<std::mutex> lock(mesh_cache_mutex);
+        const auto it = mesh_cache.find(key);
+        if (it != mesh_cache.end())
+            cached = it->second;
+        else
+            mesh_cache.emplace(key, promise.get_future().share());
+    }
+    if (cached.valid())
+        return cached.get();
+
+    try {
+        std::shared_ptr<const Mesh> mesh = read_mesh(mesh_path, decimate_ratio);
+        promise.set_value(mesh);
+        return mesh;
+    } catch (...) {
+        // Threads already waiting get the exception too, later ones try again
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(mesh_cache_mutex);
+        mesh_cache.erase(key);
+        throw;
+    }
+}
+}
+
+void cmd::clear_mesh_cache() {
+    std::lock_guard<std::mutex> lock(mesh_cache_mutex);
+    mesh_cache.clear();
 }
 
 void cmd::parse::findpenet(args::Subparser &parser) {
@@ -47,73 +123,73 @@ void cmd::parse::findpenet(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::findpenet(std::shared_ptr<cyHairFile> hairfile) {
-    // Read triangle mesh
-    log_info("Reading triangle mesh from {}", ::param.mesh_path);
-    MatrixXd OV;
-    MatrixXi OF;
-    if (!igl::read_triangle_mesh(::param.mesh_path, OV, OF)) {
-        throw std::runtime_error("Failed to read triangle mesh");
-    }
+    CliContext ctx;
+    const std::vector<unsigned int> penetrating = api::findpenet(ctx, hairfile, {
+        .mesh_path = ::param.mesh_path,
+        .decimate_ratio = ::param.decimate_ratio,
+        .threshold_ratio = ::param.threshold_ratio
+    });
 
-    // Decimate triangle mesh
-    MatrixXd V;
-    MatrixXi F;
-    if (::param.decimate_ratio < 1.0f) {
-        log_info("Decimating triangle mesh with ratio {} ({} faces)", ::param.decimate_ratio, (int)(::param.decimate_ratio * OF.rows()));
-        VectorXi J, I;
-        igl::decimate(OV, OF, ::param.decimate_ratio * OF.rows(), false, V, F, J, I);
+    globals::json["findpenet"]["penetrating_strands"] = penetrating;
+    if (!penetrating.empty()) {
+        std::stringstream ss;
+        std::copy(penetrating.begin(), penetrating.end(), std::ostream_iterator<unsigned int>(ss, ","));
+        log_warn("Found {} strands penetrating the mesh:\n{}", penetrating.size(), ::param.no_print ? std::string() : ss.str());
+        if (!::param.no_export) {
+            const std::string output_file = util::path_under_optional_dir(globals::input_file_wo_ext + "_penet.txt", globals::output_dir);
+            std::ofstream ofs(output_file);
+            ofs << ss.str();
+            log_info("Exported penetrating strands to {}", output_file);
+        }
     } else {
-        V = OV;
-        F = OF;
+        log_info("No penetrating strands found");
+    }
+
+    return {};
+}
+
+std::vector<unsigned int> api::findpenet(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const FindpenetOptions& options) {
+    const ContextScope scope(ctx);
+    if (options.decimate_ratio <= 0.0f || options.decimate_ratio > 1.0f) {
+        throw std::runtime_error("decimate_ratio must be in (0.0, 1.0]");
+    }
+    if (options.threshold_ratio < 0.0f || options.threshold_ratio > 1.0f) {
+        throw std::runtime_error("threshold_ratio must be in [0.0, 1.0]");
     }
 
+    const std::shared_ptr<const Mesh> mesh = load_mesh(options.mesh_path, options.decimate_ratio);
+
     // Convert point array in hairfile to Eigen::MatrixXd
     const auto& header = hairfile->GetHeader();
     MatrixXd P(header.point_count, 3);
-    for (unsigned int i = 0; i < header.point_count; i++) {
-        P.row(i) = Map<RowVector3f>(hairfile->GetPointsArray() + 3 * i).cast<double>();
-    }
+    parallel::for_range(header.point_count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            P.row(i) = Map<RowVector3f>(hairfile->GetPointsArray() + 3 * i).cast<double>();
+        }
+    });
 
     // Compute winding number
     log_info("Computing winding number");
     VectorXd W;
-    igl::FastWindingNumberBVH fwn_bvh;
-    igl::fast_winding_number(V,F,2,fwn_bvh);
-    igl::fast_winding_number(fwn_bvh,2,P,W);
+    igl::fast_winding_number(mesh->fwn_bvh,2,P,W);
 
     // Determine which strands are penetrating
     log_info("Determining which strands are penetrating");
-    std::set<unsigned int> penetrating;
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < header.hair_count; ++i) {
-        const unsigned int nsegs = header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? hairfile->GetSegmentsArray()[i] : header.d_segments;
-
+    std::vector<unsigned char> is_penetrating(header.hair_count, 0);
+    parallel::for_each_strand(*hairfile, [&](unsigned int i, unsigned int offset, unsigned int nsegs) {
         const double* begin = W.data() + offset;
         const double* end = begin + nsegs + 1;
 
         const unsigned int num_penetrating_points = std::count_if(begin, end, [](double x) { return x > 0.5; });
 
-        if (num_penetrating_points > ::param.threshold_ratio * (nsegs+1)) {
-            penetrating.insert(i);
-        }
-
-        offset += nsegs + 1;
-    }
-
-    globals::json["findpenet"]["penetrating_strands"] = penetrating;
-    if (!penetrating.empty()) {
-        std::stringstream ss;
-        std::copy(penetrating.begin(), penetrating.end(), std::ostream_iterator<unsigned int>(ss, ","));
-        log_warn("Found {} strands penetrating the mesh:\n{}", penetrating.size(), ::param.no_print ? std::string() : ss.str());
-        if (!::param.no_export) {
-            const std::string output_file = util::path_under_optional_dir(globals::input_file_wo_ext + "_penet.txt", globals::output_dir);
-            std::ofstream ofs(output_file);
-            ofs << ss.str();
-            log_info("Exported penetrating strands to {}", output_file);
+        if (num_penetrating_points > options.threshold_ratio * (nsegs+1)) {
+            is_penetrating[i] = 1;
         }
-    } else {
-        log_info("No penetrating strands found");
+    });
+    std::vector<unsigned int> penetrating;
+    for (unsigned int i = 0; i < header.hair_count; ++i) {
+        if (is_penetrating[i])
+            penetrating.push_back(i);
     }
-
-    return {};
+    return penetrating;
 }
@@ -1,5 +1,7 @@
 #include "cmd.h"
 #include "util.h"
+#include "parallel.h"
+#include "strands.h"
 
 #include <highfive/H5Easy.hpp>
 
@@ -28,9 +30,10 @@ std::vector<int> tovector_int(VectorXi v) {
 #endif
 
 namespace {
-struct {
+thread_local struct {
     float& angle_threshold = cmd::param::f("getcurvature", "angle_threshold");
 } param;
+
 }
 
 void cmd::parse::getcurvature(args::Subparser &parser)
@@ -48,7 +51,11 @@ void cmd::parse::getcurvature(args::Subparser &parser)
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile> hairfile) {
+    CliContext ctx;
+    const std::vector<api::StrandCurvature> results = api::getcurvature(ctx, hairfile, { .angle_threshold = ::param.angle_threshold });
+
     const std::string output_file = util::path_under_optional_dir(globals::input_file_wo_ext + "_cvtr.hdf5", globals::output_dir);
+    const std::lock_guard<std::mutex> lock(globals::hdf5_mutex);
     H5Easy::File file(output_file, H5Easy::File::Overwrite);
 
     const int num_strands = hairfile->GetHeader().hair_count;
@@ -60,52 +67,123 @@ std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile>
     }
     H5Easy::dump(file, "/nsegs", nsegs);
 
-    int offset = 0;
+    // Write results in strand order
     for (int i = 0; i < num_strands; ++i) {
-        auto scope_guard = sg::make_scope_guard([&]{
-            offset += nsegs[i] + 1;
-        });
-        if (i > 0 && i % 100 == 0)
-            log_debug("Processing hair {}/{}", i, num_strands);
+        const api::StrandCurvature& res = results[i];
+
+        H5Easy::dump(file, fmt::format("/{}/edge_length", i), res.edge_length);
+        H5Easy::dump(file, fmt::format("/{}/binormal", i), res.binormal);
+        H5Easy::dump(file, fmt::format("/{}/kappa", i), res.kappa);
+        H5Easy::dump(file, fmt::format("/{}/tau", i), res.tau);
+
+#ifndef NDEBUG
+        if (!res.straight && spdlog::get_level() <= spdlog::level::debug) {
+            happly::PLYData ply;
+
+            const VectorXf& edge_length = res.edge_length;
+            const MatrixX3f& binormal = res.binormal;
+            const int n = binormal.rows();
+
+            const unsigned int offset = hairfile->GetOffsetsArray()[i];
+            MatrixX3f point(nsegs[i]+1, 3);
+            for (int j = 0; j < nsegs[i]+1; ++j)
+                point.row(j) = Map<const RowVector3f>(hairfile->GetPointsArray() + 3*(offset+j));
+
+            VectorXf vertex_x(2*n);
+            VectorXf vertex_y(2*n);
+            VectorXf vertex_z(2*n);
+            VectorXf vertex_red = ArrayXf::LinSpaced(n, 0.0, 1.0).replicate(2, 1);
+            VectorXf vertex_green = vertex_red;
+            VectorXf vertex_blue = vertex_red;
+            vertex_x.head(n) = point.col(0).segment(1, n);
+            vertex_y.head(n) = point.col(1).segment(1, n);
+            vertex_z.head(n) = point.col(2).segment(1, n);
+            vertex_x.tail(n) = vertex_x.head(n) + edge_length(0) * binormal.col(0);
+            vertex_y.tail(n) = vertex_y.head(n) + edge_length(0) * binormal.col(1);
+            vertex_z.tail(n) = vertex_z.head(n) + edge_length(0) * binormal.col(2);
+            // MatrixX3f binormal_raw = tangent_cross.array().colwise() / tangent_cross_norm.array();
+            // vertex_x.tail(n) = vertex_x.head(n) + edge_length(0) * binormal_raw.col(0);
+            // vertex_y.tail(n) = vertex_y.head(n) + edge_length(0) * binormal_raw.col(1);
+            // vertex_z.tail(n) = vertex_z.head(n) + edge_length(0) * binormal_raw.col(2);
+            vertex_red.head(n) = VectorXf::Constant(n, 1.0);
+            vertex_blue.tail(n) = VectorXf::Constant(n, 1.0);
+
+            VectorXi edge_vertex1 = VectorXi::LinSpaced(n, 0, n-1);
+            VectorXi edge_vertex2 = edge_vertex1.array() + n;
+
+            ply.addElement("vertex", 2*n);
+            ply.getElement("vertex").addProperty<float>("x", tovector_f(vertex_x));
+            ply.getElement("vertex").addProperty<float>("y", tovector_f(vertex_y));
+            ply.getElement("vertex").addProperty<float>("z", tovector_f(vertex_z));
+            ply.getElement("vertex").addProperty<unsigned char>("red", tovector_uchar(vertex_red));
+            ply.getElement("vertex").addProperty<unsigned char>("green", tovector_uchar(vertex_green));
+            ply.getElement("vertex").addProperty<unsigned char>("blue", tovector_uchar(vertex_blue));
+
+            ply.addElement("edge", n);
+            ply.getElement("edge").addProperty<int>("vertex1", tovector_int(edge_vertex1));
+            ply.getElement("edge").addProperty<int>("vertex2", tovector_int(edge_vertex2));
+
+            ply.write(globals::input_file_wo_ext + "_cvtr_debug.ply", globals::ply_save_ascii ? happly::DataFormat::ASCII : happly::DataFormat::Binary);
+            log_debug("Wrote debug info to {}", globals::input_file_wo_ext + "_cvtr_debug.ply");
+            break;
+        }
+#endif
+    }
+    log_info("Written to {}", output_file);
+
+    return {};
+}
 
-        // Copy point data to Eigen array
-        MatrixX3f point(nsegs[i]+1, 3);
-        for (int j = 0; j < nsegs[i]+1; ++j)
-            point.row(j) = Map<const RowVector3f>(hairfile->GetPointsArray() + 3*(offset+j));
+std::vector<api::StrandCurvature> api::getcurvature(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const GetcurvatureOptions& options) {
+    const ContextScope scope(ctx);
+    const int num_strands = hairfile->GetHeader().hair_count;
+
+    // Compute curvature & torsion of every strand
+    const Strands strands(*hairfile, false);
+    std::vector<StrandCurvature> results(num_strands);
+    parallel::for_each_strand(strands.offsets, [&](int i, int offset, int nsegs) {
+        StrandCurvature& res = results[i];
+
+        // Copy point data to Eigen array, one contiguous SoA column at a time
+        MatrixX3f point(nsegs+1, 3);
+        point.col(0) = Map<const VectorXf>(strands.x.data() + offset, nsegs+1);
+        point.col(1) = Map<const VectorXf>(strands.y.data() + offset, nsegs+1);
+        point.col(2) = Map<const VectorXf>(strands.z.data() + offset, nsegs+1);
 
         // Get unit tangent vector
-        const MatrixX3f edge = point.block(1, 0, nsegs[i], 3) - point.block(0, 0, nsegs[i], 3);
-        const VectorXf edge_length = edge.rowwise().norm();
+        const MatrixX3f edge = point.block(1, 0, nsegs, 3) - point.block(0, 0, nsegs, 3);
+        res.edge_length = edge.rowwise().norm();
+        const VectorXf& edge_length = res.edge_length;
         const MatrixX3f tangent = edge.array().colwise() / edge_length.array();
-        const VectorXf vertex_length = 0.5 * (edge_length.head(nsegs[i]-1) + edge_length.tail(nsegs[i]-1));
-
-        H5Easy::dump(file, fmt::format("/{}/edge_length", i), edge_length);
+        const VectorXf vertex_length = 0.5 * (edge_length.head(nsegs-1) + edge_length.tail(nsegs-1));
 
         // Get cross-product of consecutive tangent vectors
-        MatrixX3f tangent_cross(nsegs[i]-1, 3);
-        for (int j = 0; j < nsegs[i]-1; ++j)
+        MatrixX3f tangent_cross(nsegs-1, 3);
+        for (int j = 0; j < nsegs-1; ++j)
             tangent_cross.row(j) = tangent.row(j).cross(tangent.row(j+1));
         const VectorXf tangent_cross_norm = tangent_cross.rowwise().norm();
         const VectorXf turning_angle = tangent_cross_norm.array().asin();
 
-        const VectorXi is_straight = (turning_angle.array() < ::param.angle_threshold * globals::pi / 180.0).cast<int>();
+        const VectorXi is_straight = (turning_angle.array() < options.angle_threshold * globals::pi / 180.0).cast<int>();
 
         // If the strand is completely straight, simply set binormal to a random vector
-        if (is_straight.sum() == nsegs[i]-1) {
-            log_warn("Strand {} is completely straight", i);
-            RowVector3f binormal = RowVector3f::Random();
+        if (is_straight.sum() == nsegs-1) {
+            Philox4x32 rng(ctx.seed, i);
+            std::uniform_real_distribution<float> dist(-1, 1);
+            RowVector3f binormal(dist(rng), dist(rng), dist(rng));
             binormal = (binormal - binormal.dot(tangent.row(0)) * tangent.row(0)).normalized();
-            H5Easy::dump(file, fmt::format("/{}/binormal", i),  binormal.replicate(nsegs[i]-1, 1).eval());
-            H5Easy::dump(file, fmt::format("/{}/kappa", i), std::vector<float>(nsegs[i]-1, 0.0));
-            H5Easy::dump(file, fmt::format("/{}/tau", i), std::vector<float>(nsegs[i]-2, 0.0));
-            continue;
+            res.straight = true;
+            res.binormal = binormal.replicate(nsegs-1, 1);
+            res.kappa.assign(nsegs-1, 0.0);
+            res.tau.assign(nsegs-2, 0.0);
+            return;
         }
 
         MatrixX3f binormal = tangent_cross.array().colwise() / tangent_cross_norm.array();
 
         // Find indices where is_straight(j) != is_straight(j+1)
         std::vector<int> transition;
-        for (int j = 0; j < nsegs[i]-2; ++j) {
+        for (int j = 0; j < nsegs-2; ++j) {
             if (is_straight(j) != is_straight(j+1))
                 transition.push_back(j);
         }
@@ -122,7 +200,7 @@ std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile>
                 if (binormal_0.dot(binormal_1) < 0.0) {
                     binormal_1 = -binormal_1;
                     // Flip binormal for the rest of the strand
-                    for (int j = t2+1; j < nsegs[i]-1; ++j)
+                    for (int j = t2+1; j < nsegs-1; ++j)
                         binormal.row(j) = -binormal.row(j);
                 }
 
@@ -147,13 +225,14 @@ std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile>
                 binormal.row(j) = binormal.row(transition.front()+1);
         }
         if (!transition.empty() && !is_straight(transition.back())) {
-            for (int j = transition.back()+1; j < nsegs[i]-1; ++j)
+            for (int j = transition.back()+1; j < nsegs-1; ++j)
                 binormal.row(j) = binormal.row(transition.back());
         }
 
         // Compute curvature
-        std::vector<float> kappa(nsegs[i]-1);
-        for (int j = 0; j < nsegs[i]-1; ++j) {
+        std::vector<float>& kappa = res.kappa;
+        kappa.resize(nsegs-1);
+        for (int j = 0; j < nsegs-1; ++j) {
             if (is_straight(j)) {
                 kappa[j] = 0.0;
             } else {
@@ -164,8 +243,9 @@ std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile>
         }
 
         // Compute torsion
-        std::vector<float> tau(nsegs[i]-2);
-        for (int j = 0; j < nsegs[i]-2; ++j) {
+        std::vector<float>& tau = res.tau;
+        tau.resize(nsegs-2);
+        for (int j = 0; j < nsegs-2; ++j) {
             const Vector3f binormal_cross = binormal.row(j).cross(binormal.row(j+1));
             const float angle = std::asin(std::clamp(binormal_cross.norm(), -1.0f, 1.0f));
             tau[j] = angle / edge_length(j+1);
@@ -173,57 +253,13 @@ std::shared_ptr<cyHairFile> cmd::exec::getcurvature(std::shared_ptr<cyHairFile>
                 tau[j] = -tau[j];
         }
 
-        H5Easy::dump(file, fmt::format("/{}/binormal", i), binormal);
-        H5Easy::dump(file, fmt::format("/{}/kappa", i), kappa);
-        H5Easy::dump(file, fmt::format("/{}/tau", i), tau);
-
-#ifndef NDEBUG
-        if (spdlog::get_level() <= spdlog::level::debug) {
-            happly::PLYData ply;
-
-            const int n = binormal.rows();
-
-            VectorXf vertex_x(2*n);
-            VectorXf vertex_y(2*n);
-            VectorXf vertex_z(2*n);
-            VectorXf vertex_red = ArrayXf::LinSpaced(n, 0.0, 1.0).replicate(2, 1);
-            VectorXf vertex_green = vertex_red;
-            VectorXf vertex_blue = vertex_red;
-            vertex_x.head(n) = point.col(0).segment(1, n);
-            vertex_y.head(n) = point.col(1).segment(1, n);
-            vertex_z.head(n) = point.col(2).segment(1, n);
-            vertex_x.tail(n) = vertex_x.head(n) + edge_length(0) * binormal.col(0);
-            vertex_y.tail(n) = vertex_y.head(n) + edge_length(0) * binormal.col(1);
-            vertex_z.tail(n) = vertex_z.head(n) + edge_length(0) * binormal.col(2);
-            // MatrixX3f binormal_raw = tangent_cross.array().colwise() / tangent_cross_norm.array();
-            // vertex_x.tail(n) = vertex_x.head(n) + edge_length(0) * binormal_raw.col(0);
-            // vertex_y.tail(n) = vertex_y.head(n) + edge_length(0) * binormal_raw.col(1);
-            // vertex_z.tail(n) = vertex_z.head(n) + edge_length(0) * binormal_raw.col(2);
-            vertex_red.head(n) = VectorXf::Constant(n, 1.0);
-            vertex_blue.tail(n) = VectorXf::Constant(n, 1.0);
-
-            VectorXi edge_vertex1 = VectorXi::LinSpaced(n, 0, n-1);
-            VectorXi edge_vertex2 = edge_vertex1.array() + n;
-
-            ply.addElement("vertex", 2*n);
-            ply.getElement("vertex").addProperty<float>("x", tovector_f(vertex_x));
-            ply.getElement("vertex").addProperty<float>("y", tovector_f(vertex_y));
-            ply.getElement("vertex").addProperty<float>("z", tovector_f(vertex_z));
-            ply.getElement("vertex").addProperty<unsigned char>("red", tovector_uchar(vertex_red));
-            ply.getElement("vertex").addProperty<unsigned char>("green", tovector_uchar(vertex_green));
-            ply.getElement("vertex").addProperty<unsigned char>("blue", tovector_uchar(vertex_blue));
+        res.binormal = std::move(binormal);
+    });
 
-            ply.addElement("edge", n);
-            ply.getElement("edge").addProperty<int>("vertex1", tovector_int(edge_vertex1));
-            ply.getElement("edge").addProperty<int>("vertex2", tovector_int(edge_vertex2));
-
-            ply.write(globals::input_file_wo_ext + "_cvtr_debug.ply", globals::ply_save_ascii ? happly::DataFormat::ASCII : happly::DataFormat::Binary);
-            log_debug("Wrote debug info to {}", globals::input_file_wo_ext + "_cvtr_debug.ply");
-            break;
-        }
-#endif
+    // Warn after the parallel loop, so that the log is in strand order
+    for (int i = 0; i < num_strands; ++i) {
+        if (results[i].straight)
+            log_warn("Strand {} is completely straight", i);
     }
-    log_info("Written to {}", output_file);
-
-    return {};
+    return results;
 }
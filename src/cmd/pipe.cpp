@@ -0,0 +1,141 @@
+#include "cmd.h"
+#include "util.h"
+
+namespace {
+struct Stage {
+    std::vector<std::string> args;
+    cmd::exec_func_t exec;
+    std::function<std::string(void)> output_file_wo_ext;
+    std::function<void(void)> check_error;
+};
+thread_local std::vector<Stage> stages;
+
+std::string to_string(const Stage& stage) {
+    std::string res;
+    for (const std::string& arg : stage.args)
+        res += (res.empty() ? "" : " ") + arg;
+    return res;
+}
+
+// Parse the arguments of a stage with the parser of its command, which sets the command's parameters.
+// The hooks set by the command are stored in the stage, leaving those of the pipe command intact.
+void parse_stage(Stage& stage, bool is_last) {
+    const cmd::exec_func_t cmd_exec = globals::cmd_exec;
+    OutputFile output_file_wo_ext = std::move(globals::output_file_wo_ext);
+    std::function<void(void)> check_error = std::move(globals::check_error);
+    auto scope_guard = sg::make_scope_guard([&]{
+        globals::cmd_exec = cmd_exec;
+        globals::output_file_wo_ext = std::move(output_file_wo_ext);
+        globals::check_error = std::move(check_error);
+    });
+    globals::cmd_exec = nullptr;
+    globals::output_file_wo_ext = OutputFile{};
+    globals::check_error = {};
+
+    // Commands that write their own outputs based on the final output name (decompose) or that do nothing (convert) are left out
+    args::ArgumentParser parser("");
+    args::Group grp_commands(parser, "Commands:");
+    args::Command cmd_autofix(grp_commands, "autofix", "Auto-fix issues", cmd::parse::autofix);
+    args::Command cmd_filter(grp_commands, "filter", "Extract strands that pass given filter", cmd::parse::filter);
+    args::Command cmd_findpenet(grp_commands, "findpenet", "Find penetration against head mesh", cmd::parse::findpenet);
+    args::Command cmd_getcurvature(grp_commands, "getcurvature", "Get discrete curvature & torsion", cmd::parse::getcurvature);
+    args::Command cmd_info(grp_commands, "info", "Print information", cmd::parse::info);
+    args::Command cmd_resample(grp_commands, "resample", "Resample strands", cmd::parse::resample);
+    args::Command cmd_smooth(grp_commands, "smooth", "Smooth strands", cmd::parse::smooth);
+    args::Command cmd_stats(grp_commands, "stats", "Generate statistics", cmd::parse::stats);
+    args::Command cmd_subsample(grp_commands, "subsample", "Subsample strands", cmd::parse::subsample);
+    args::Command cmd_transform(grp_commands, "transform", "Transform strand points", cmd::parse::transform);
+    args::Command cmd_tubify(grp_commands, "tubify", "Turn curves into tubes as triangle mesh", cmd::parse::tubify);
+    args::Group grp_globals("Common options:");
+    args::ValueFlag<std::string> output_ext(grp_globals, "EXT", "Output file extension (or extensions by comma-delimited list)", {'o', "output-ext"}, "");
+    args::GlobalOptions global_options(parser, grp_globals);
+
+    parser.ParseArgs(stage.args);
+
+    if (output_ext) {
+        if (!is_last)
+            throw args::ValidationError("--output-ext can only be given to the last stage: " + to_string(stage));
+        globals::output_exts = util::container_cast<std::set<std::string>>(util::parse_comma_separated_values<std::string>(*output_ext));
+    }
+
+    stage.exec = globals::cmd_exec;
+    stage.output_file_wo_ext = globals::output_file_wo_ext.func;
+    stage.check_error = globals::check_error;
+}
+
+// Call func(stage) for every stage after parsing it, with globals::input_file_wo_ext set to the output name of the previous stages
+void for_each_stage(const std::function<void(Stage&)>& func) {
+    const std::string input_file_wo_ext = globals::input_file_wo_ext;
+    auto scope_guard = sg::make_scope_guard([&]{
+        globals::input_file_wo_ext = input_file_wo_ext;
+    });
+    for (size_t k = 0; k < stages.size(); ++k) {
+        Stage& stage = stages[k];
+        parse_stage(stage, k + 1 == stages.size());
+        func(stage);
+        if (stage.output_file_wo_ext)
+            globals::input_file_wo_ext = stage.output_file_wo_ext();
+    }
+}
+}
+
+void cmd::parse::pipe(args::Subparser &parser) {
+    args::PositionalList<std::string> stage_args(parser, "STAGES", "Commands with their options, separated by ':' (e.g. -- transform -s 0.01 : resample -l 0.5 : smooth)");
+    parser.Parse();
+    globals::cmd_exec = cmd::exec::pipe;
+
+    // Split into stages
+    stages = { Stage{} };
+    for (const std::string& arg : *stage_args) {
+        if (arg == ":")
+            stages.push_back({});
+        else
+            stages.back().args.push_back(arg);
+    }
+    for (const Stage& stage : stages) {
+        if (stage.args.empty())
+            throw args::ValidationError("Empty stage in pipe");
+    }
+
+    // Parse every stage upfront so that errors are reported before loading
+    bool has_output = false;
+    for (size_t k = 0; k < stages.size(); ++k) {
+        parse_stage(stages[k], k + 1 == stages.size());
+        has_output |= static_cast<bool>(stages[k].output_file_wo_ext);
+    }
+
+    if (has_output) {
+        globals::output_file_wo_ext = [](){
+            std::string output_file_wo_ext;
+            for_each_stage([&](Stage& stage) {
+                if (stage.output_file_wo_ext)
+                    output_file_wo_ext = stage.output_file_wo_ext();
+            });
+            return output_file_wo_ext;
+        };
+    }
+    globals::check_error = [](){
+        for_each_stage([](Stage& stage) {
+            if (stage.check_error)
+                stage.check_error();
+        });
+    };
+}
+
+std::shared_ptr<cyHairFile> cmd::exec::pipe(std::shared_ptr<cyHairFile> hairfile_in) {
+    std::shared_ptr<cyHairFile> hairfile_out;
+    size_t k = 0;
+    for_each_stage([&](Stage& stage) {
+        log_info("Stage {}/{}: {}", ++k, stages.size(), to_string(stage));
+        auto hairfile_stage = stage.exec(hairfile_out ? hairfile_out : hairfile_in);
+
+        // Strands selected by a stage are only copied if a later stage needs them; those of the last stage are saved from the view
+        if (globals::output_subset && k < stages.size()) {
+            hairfile_stage = globals::output_subset->materialize();
+            globals::output_subset = {};
+        }
+        if (hairfile_stage)
+            hairfile_out = hairfile_stage;
+    });
+    return globals::output_subset ? nullptr : hairfile_out;
+}
@@ -1,10 +1,11 @@
 #include "cmd.h"
+#include "parallel.h"
 #include "util.h"
 
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
     float& target_segment_length = cmd::param::f("resample", "target_segment_length");
     bool& linear_subdiv = cmd::param::b("resample", "linear_subdiv");
     bool& catmull_rom = cmd::param::b("resample", "catmull_rom");
@@ -160,9 +161,30 @@ void cmd::parse::resample(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hairfile_in) {
+    CliContext ctx;
+    return api::resample(ctx, hairfile_in, {
+        .target_segment_length = ::param.target_segment_length,
+        .linear_subdiv = ::param.linear_subdiv,
+        .catmull_rom = ::param.catmull_rom,
+        .cr_power = ::param.cr_power,
+        .c2_interp = ::param.c2_interp
+    });
+}
+
+std::shared_ptr<cyHairFile> api::resample(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in, const ResampleOptions& options) {
+    const ContextScope scope(ctx);
+    if (options.target_segment_length < 0) {
+        throw std::runtime_error(fmt::format("Invalid target segment length: {}", options.target_segment_length));
+    }
+    if (options.target_segment_length == 0 && (options.linear_subdiv || options.catmull_rom || options.c2_interp)) {
+        throw std::runtime_error("When target_segment_length is 0, none of linear_subdiv, catmull_rom, or c2_interp can be set");
+    }
+    if (options.linear_subdiv + options.catmull_rom + options.c2_interp > 1) {
+        throw std::runtime_error("linear_subdiv, catmull_rom, and c2_interp are mutually exclusive");
+    }
+
     const auto& header_in = hairfile_in->GetHeader();
 
-    const bool has_segments = hairfile_in->GetSegmentsArray() != nullptr;
     const bool has_thickness = hairfile_in->GetThicknessArray() != nullptr;
     const bool has_transparency = hairfile_in->GetTransparencyArray() != nullptr;
     const bool has_color = hairfile_in->GetColorsArray() != nullptr;
@@ -174,13 +196,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
     std::vector<std::vector<float>> transparency_per_strand(hair_count);
     std::vector<std::vector<float>> color_per_strand(hair_count);
 
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < hair_count; ++i) {
-        if (i > 0 && i % 100 == 0)
-            log_debug("Processing hair {}/{}", i, hair_count);
-
-        const unsigned int num_segments = has_segments ? hairfile_in->GetSegmentsArray()[i] : header_in.d_segments;
-
+    parallel::for_each_strand(*hairfile_in, [&](unsigned int i, unsigned int offset, unsigned int num_segments) {
         std::vector<unsigned int> j_range(num_segments);
         std::iota(j_range.begin(), j_range.end(), 0);
 
@@ -194,7 +210,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
 
         // Preparation for catmull-rom mode
         std::vector<float> segment_length_pow;
-        std::transform(segment_length.begin(), segment_length.end(), std::back_inserter(segment_length_pow), [](float l) { return std::pow(l, ::param.cr_power); });
+        std::transform(segment_length.begin(), segment_length.end(), std::back_inserter(segment_length_pow), [&](float l) { return std::pow(l, options.cr_power); });
         std::vector<float> knots;
         std::partial_sum(segment_length_pow.begin(), segment_length_pow.end(), std::back_inserter(knots));
         knots.insert(knots.begin(), 0);
@@ -202,10 +218,10 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
         // Preparation for c2-interp mode
         std::optional<Circle> curve1;
 
-        if (::param.linear_subdiv || ::param.catmull_rom || ::param.c2_interp) {
+        if (options.linear_subdiv || options.catmull_rom || options.c2_interp) {
             std::vector<unsigned int> num_subsegments_per_segment(num_segments);
             for (unsigned int j : j_range) {
-                num_subsegments_per_segment[j] = (unsigned int)std::ceil(segment_length[j] / ::param.target_segment_length);
+                num_subsegments_per_segment[j] = (unsigned int)std::ceil(segment_length[j] / options.target_segment_length);
             }
 
             const unsigned int num_subsegments_total = std::accumulate(num_subsegments_per_segment.begin(), num_subsegments_per_segment.end(), 0);
@@ -236,7 +252,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
                 }
                 Vector3f p_last = point0;
 
-                if (::param.linear_subdiv || num_segments == 1) {
+                if (options.linear_subdiv || num_segments == 1) {
                     for (unsigned int k = 0; k < num_subsegments_per_segment[j]; ++k) {
                         const float t = (k + 1) / (float)num_subsegments_per_segment[j];
                         util::push_back_vec3(points_per_strand[i], util::lerp(point0, point1, t));
@@ -244,7 +260,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
                         if (has_transparency) transparency_per_strand[i].push_back(util::lerp(*transparency0, *transparency1, t));
                         if (has_color) util::push_back_vec3(color_per_strand[i], util::lerp(*color0, *color1, t));
                     }
-                } else if (::param.catmull_rom) {
+                } else if (options.catmull_rom) {
                     auto cr_interpolate_1f = [&offset, &num_segments, &knots, &j](const float t, float * const array) -> float {
                         float t0{}, t1{}, t2{}, t3{};
                         float p0{}, p1{}, p2{}, p3{};
@@ -301,7 +317,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
                         Vector3f p;
                         while (true) {
                             p = cr_interpolate_3f(t + dt, hairfile_in->GetPointsArray());
-                            if ((p - p_last).norm() >= ::param.target_segment_length) break;
+                            if ((p - p_last).norm() >= options.target_segment_length) break;
                             dt *= 1.1f;
                             if (dt > knots[j + 1] - knots[j]) break;
                         }
@@ -317,7 +333,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
                     if (has_thickness) thickness_per_strand[i].push_back(*thickness1);
                     if (has_transparency) transparency_per_strand[i].push_back(*transparency1);
                     if (has_color) util::push_back_vec3(color_per_strand[i], *color1);
-                } else if (::param.c2_interp) {
+                } else if (options.c2_interp) {
                     Circle curve2;
                     if (j == num_segments - 1) {
                         curve2 = {
@@ -350,7 +366,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
                         Vector3f p;
                         while (true) {
                             p = c2i_interpolate(*curve1, curve2, t + dt);
-                            if ((p - p_last).norm() >= ::param.target_segment_length) break;
+                            if ((p - p_last).norm() >= options.target_segment_length) break;
                             dt *= 1.1f;
                             if (dt > 1.f) break;
                         }
@@ -372,7 +388,7 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
         } else {
             const unsigned int num_points = num_segments + 1;
             const double total_length = std::accumulate(segment_length.begin(), segment_length.end(), 0.0);
-            const unsigned int target_num_points = ::param.target_segment_length ? static_cast<unsigned int>(std::ceil(total_length / ::param.target_segment_length)) + 1 : num_points;
+            const unsigned int target_num_points = options.target_segment_length ? static_cast<unsigned int>(std::ceil(total_length / options.target_segment_length)) + 1 : num_points;
 
             auto append_point = [&](const Vector3f& point,
                                     const std::optional<float>& thickness,
@@ -446,13 +462,18 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
             }
             append_point_at(num_points - 1);
         }
+    });
 
-        offset += num_segments + 1;
+    // Compute output offsets of each strand
+    std::vector<unsigned int> out_offsets(hair_count + 1, 0);
+    for (unsigned int i = 0; i < hair_count; ++i) {
+        const size_t num_points_per_strand = points_per_strand[i].size() / 3;
+        if (num_points_per_strand - 1 > std::numeric_limits<unsigned short>::max()) {
+            throw std::runtime_error(fmt::format("Number of segments per strand {} exceeds the maximum limit: {}", num_points_per_strand - 1, std::numeric_limits<unsigned short>::max()));
+        }
+        out_offsets[i + 1] = out_offsets[i] + num_points_per_strand;
     }
-
-    const unsigned int num_points_total = std::accumulate(points_per_strand.begin(), points_per_strand.end(), 0,
-        [](unsigned int sum, const std::vector<float>& v){ return sum + v.size() / 3; }
-    );
+    const unsigned int num_points_total = out_offsets[hair_count];
 
     // Create output hair file
     std::shared_ptr<cyHairFile> hairfile_out = std::make_shared<cyHairFile>();
@@ -466,23 +487,20 @@ std::shared_ptr<cyHairFile> cmd::exec::resample(std::shared_ptr<cyHairFile> hair
     hairfile_out->SetArrays(header_in.arrays | _CY_HAIR_FILE_SEGMENTS_BIT);
 
     // Copy data to arrays of hairfile_out
-    offset = 0;
-    for (unsigned int i = 0; i < hair_count; ++i) {
-        const size_t num_points_per_strand = points_per_strand[i].size() / 3;
-        if (num_points_per_strand - 1 > std::numeric_limits<unsigned short>::max()) {
-            throw std::runtime_error(fmt::format("Number of segments per strand {} exceeds the maximum limit: {}", num_points_per_strand - 1, std::numeric_limits<unsigned short>::max()));
-        }
-
-        hairfile_out->GetSegmentsArray()[i] = num_points_per_strand - 1;
+    parallel::for_range(hair_count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const size_t num_points_per_strand = points_per_strand[i].size() / 3;
+            const unsigned int offset = out_offsets[i];
 
-        std::memcpy(hairfile_out->GetPointsArray() + 3*offset, points_per_strand[i].data(), 3*num_points_per_strand*sizeof(float));
+            hairfile_out->GetSegmentsArray()[i] = num_points_per_strand - 1;
 
-        if (has_thickness) std::memcpy(hairfile_out->GetThicknessArray() + offset, thickness_per_strand[i].data(), num_points_per_strand*sizeof(float));
-        if (has_transparency) std::memcpy(hairfile_out->GetTransparencyArray() + offset, transparency_per_strand[i].data(), num_points_per_strand*sizeof(float));
-        if (has_color) std::memcpy(hairfile_out->GetColorsArray() + 3*offset, color_per_strand[i].data(), 3*num_points_per_strand*sizeof(float));
+            std::memcpy(hairfile_out->GetPointsArray() + 3*offset, points_per_strand[i].data(), 3*num_points_per_strand*sizeof(float));
 
-        offset += num_points_per_strand;
-    }
+            if (has_thickness) std::memcpy(hairfile_out->GetThicknessArray() + offset, thickness_per_strand[i].data(), num_points_per_strand*sizeof(float));
+            if (has_transparency) std::memcpy(hairfile_out->GetTransparencyArray() + offset, transparency_per_strand[i].data(), num_points_per_strand*sizeof(float));
+            if (has_color) std::memcpy(hairfile_out->GetColorsArray() + 3*offset, color_per_strand[i].data(), 3*num_points_per_strand*sizeof(float));
+        }
+    });
 
     return hairfile_out;
 }
@@ -1,4 +1,5 @@
 #include "cmd.h"
+#include "parallel.h"
 
 #include <igl/min_quad_with_fixed.h>
 #include <igl/speye.h>
@@ -6,7 +7,7 @@
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
     float& lambda = cmd::param::f("smooth", "lambda");
 } param;
 }
@@ -25,25 +26,25 @@ void cmd::parse::smooth(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::smooth(std::shared_ptr<cyHairFile> hairfile) {
-    const int hair_count = hairfile->GetHeader().hair_count;
+    CliContext ctx;
+    return api::smooth(ctx, hairfile, { .lambda = ::param.lambda });
+}
 
-    int offset = 0;
-    for (int i = 0; i < hair_count; ++i) {
-        if (i > 0 && i % 100 == 0)
-            log_debug("Processing hair {}/{}", i, hair_count);
+std::shared_ptr<cyHairFile> api::smooth(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const SmoothOptions& options) {
+    const ContextScope scope(ctx);
+    if (options.lambda <= 0) {
+        throw std::runtime_error("Smoothness weight must be positive");
+    }
 
-        const int nsegs = hairfile->GetSegmentsArray() ? hairfile->GetSegmentsArray()[i] : hairfile->GetHeader().d_segments;
+    parallel::for_each_strand(*hairfile, [&](int i, int offset, int nsegs) {
         const int n = nsegs + 1;
 
+        if (nsegs < 2)
+            return;
+
         // Copy point data to Eigen matrix
-        auto scope_guard = sg::make_scope_guard([&]{
-            offset += nsegs + 1;
-        });
         MatrixX3d f = Map<Matrix3Xf>(hairfile->GetPointsArray() + 3*offset, 3, nsegs+1).cast<double>().transpose();
 
-        if (nsegs < 2)
-            continue;
-
         /*
         Energy to be minimized for coordinate function f:
             E_data(f) = 1/2 Σ_i (f_i - f_0_i)^2
@@ -67,7 +68,7 @@ std::shared_ptr<cyHairFile> cmd::exec::smooth(std::shared_ptr<cyHairFile> hairfi
         }
         D.setFromTriplets(D_triplets.begin(), D_triplets.end());
 
-        const SparseMatrix<double> Q = I + ::param.lambda*(D.transpose()*D);
+        const SparseMatrix<double> Q = I + options.lambda*(D.transpose()*D);
         const VectorXi b = (VectorXi(2) << 0, n - 1).finished();
         const MatrixX3d bc = (MatrixX3d(2, 3) << f.row(0), f.row(n - 1)).finished();
         const SparseMatrix<double> Aeq;
@@ -79,6 +80,6 @@ std::shared_ptr<cyHairFile> cmd::exec::smooth(std::shared_ptr<cyHairFile> hairfi
         // Copy resulting point data back to hairfile
         Matrix3Xf f_T = f.transpose().cast<float>();
         std::memcpy(hairfile->GetPointsArray() + 3*offset, f_T.data(), 3*(nsegs+1)*sizeof(float));
-    }
+    });
     return hairfile;
 }
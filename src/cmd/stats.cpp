@@ -1,4 +1,6 @@
 #include "cmd.h"
+#include "parallel.h"
+#include "strands.h"
 #include "util.h"
 
 #include <xlnt/xlnt.hpp>
@@ -7,7 +9,7 @@ using namespace Eigen;
 
 namespace {
 
-struct {
+thread_local struct {
     unsigned int& sort_size = cmd::param::ui("stats", "sort_size");
     bool& no_export = cmd::param::b("stats", "no_export");
     bool& export_raw_strand = cmd::param::b("stats", "export_raw_strand");
@@ -16,38 +18,6 @@ struct {
     bool& no_print = cmd::param::b("stats", "no_print");
 } param;
 
-struct StrandInfo {
-    size_t idx = 0;
-    unsigned int nsegs = 0;
-    float length = 0;
-    float turning_angle_sum = 0;
-    float max_segment_length = 0;
-    float min_segment_length = std::numeric_limits<float>::max();
-    float max_segment_turning_angle_diff = 0;
-    float min_segment_turning_angle_diff = std::numeric_limits<float>::max();
-    float max_point_circumradius_reciprocal = 0;
-    float min_point_circumradius_reciprocal = std::numeric_limits<float>::max();
-    float max_point_turning_angle = 0;
-    float min_point_turning_angle = std::numeric_limits<float>::max();
-    float max_point_curvature = 0;
-    float min_point_curvature = std::numeric_limits<float>::max();
-};
-struct SegmentInfo {
-    size_t idx = 0;
-    unsigned int strand_idx = 0;
-    unsigned int local_idx = 0;         // Index of the segment within the strand
-    float length = 0;
-    float turning_angle_diff = 0;
-};
-struct PointInfo {
-    size_t idx = 0;                   // Index of the center point into the global points array
-    unsigned int strand_idx = 0;
-    unsigned int local_idx = 0;             // Index of the center point within the strand points
-    float circumradius_reciprocal = 0;      // Reciprocal of the circumradius of the wedge triangle formed by the point and its two neighbors
-    float turning_angle = 0;
-    float curvature = 0;                    // Discrete curvature (turning_angle_rad / segment_length_average)
-};
-
 }
 
 void cmd::parse::stats(args::Subparser &parser) {
@@ -82,83 +52,11 @@ void cmd::parse::stats(args::Subparser &parser) {
 std::shared_ptr<cyHairFile> cmd::exec::stats(std::shared_ptr<cyHairFile> hairfile_in) {
     const auto& header = hairfile_in->GetHeader();
 
-    std::vector<StrandInfo> strand_info_vec;    strand_info_vec.reserve(header.hair_count);
-    std::vector<SegmentInfo> segment_info_vec;  segment_info_vec.reserve(header.point_count);
-    std::vector<PointInfo> point_info_vec;      point_info_vec.reserve(header.point_count);
-
-    // Collect raw data
-    log_info("Collecting raw data");
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < header.hair_count; ++i) {
-        const unsigned int nsegs = header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? hairfile_in->GetSegmentsArray()[i] : header.d_segments;
-
-        StrandInfo strand_info;
-        strand_info.idx = strand_info_vec.size();
-        strand_info.nsegs = nsegs;
-
-        Vector3f prev_point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * offset);
-        float prev_turning_angle;
-        for (unsigned int j = 0; j < nsegs; ++j) {
-            const Vector3f point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * (offset + j + 1));
-            const float segment_length = (point - prev_point).norm();
-
-            SegmentInfo segment_info;
-            segment_info.idx = segment_info_vec.size();
-            segment_info.strand_idx = i;
-            segment_info.local_idx = j;
-            segment_info.length = segment_length;
-
-            if (j < nsegs - 1) {
-                // Compute the circumradius of the wedge triangle
-                const Vector3f next_point = Map<const Vector3f>(hairfile_in->GetPointsArray() + 3 * (offset + j + 2));
-                const float la = (point - prev_point).norm();
-                const float lb = (next_point - point).norm();
-                const float lc = (next_point - prev_point).norm();
-                const float s = (la + lb + lc) / 2.0f;
-                const float A = std::sqrt(s * (s - la) * (s - lb) * (s - lc));
-                const float circumradius_reciprocal = A > 0.0f ? 1.0f / (la * lb * lc / (4.0f * A)) : 0.0f;
-                const float turning_angle_rad = globals::pi - std::acos(std::clamp((la * la + lb * lb - lc * lc) / (2.0f * la * lb), -1.0f, 1.0f));
-                const float turning_angle = turning_angle_rad * 180.0f / globals::pi;
-                const float curvature = turning_angle_rad / ((la + lb) / 2.0f);
-
-                PointInfo point_info;
-                point_info.idx = offset + j + 1;
-                point_info.strand_idx = i;
-                point_info.local_idx = j + 1;
-                point_info.circumradius_reciprocal = circumradius_reciprocal;
-                point_info.turning_angle = turning_angle;
-                point_info.curvature = curvature;
-                point_info_vec.push_back(point_info);
-
-                if (j > 0) {
-                    segment_info.turning_angle_diff = std::abs(turning_angle - prev_turning_angle);
-
-                    strand_info.max_segment_turning_angle_diff = std::max(strand_info.max_segment_turning_angle_diff, segment_info.turning_angle_diff);
-                    strand_info.min_segment_turning_angle_diff = std::min(strand_info.min_segment_turning_angle_diff, segment_info.turning_angle_diff);
-                }
-                prev_turning_angle = turning_angle;
-
-                strand_info.turning_angle_sum += turning_angle;
-
-                strand_info.max_point_circumradius_reciprocal = std::max(strand_info.max_point_circumradius_reciprocal, circumradius_reciprocal);
-                strand_info.min_point_circumradius_reciprocal = std::min(strand_info.min_point_circumradius_reciprocal, circumradius_reciprocal);
-                strand_info.max_point_turning_angle = std::max(strand_info.max_point_turning_angle, turning_angle);
-                strand_info.min_point_turning_angle = std::min(strand_info.min_point_turning_angle, turning_angle);
-                strand_info.max_point_curvature = std::max(strand_info.max_point_curvature, curvature);
-                strand_info.min_point_curvature = std::min(strand_info.min_point_curvature, curvature);
-            }
-            segment_info_vec.push_back(segment_info);
-
-            strand_info.length += segment_length;
-            strand_info.max_segment_length = std::max(strand_info.max_segment_length, segment_length);
-            strand_info.min_segment_length = std::min(strand_info.min_segment_length, segment_length);
-            prev_point = point;
-        }
-
-        strand_info_vec.push_back(strand_info);
-
-        offset += nsegs + 1;
-    }
+    CliContext ctx;
+    api::StatsResult result = api::stats(ctx, hairfile_in);
+    std::vector<api::StrandInfo>& strand_info_vec = result.strands;
+    std::vector<api::SegmentInfo>& segment_info_vec = result.segments;
+    std::vector<api::PointInfo>& point_info_vec = result.points;
 
     xlnt::workbook wb;
 
@@ -273,7 +171,7 @@ std::shared_ptr<cyHairFile> cmd::exec::stats(std::shared_ptr<cyHairFile> hairfil
     // Compute stats
     log_info("Computing stats");
 
-    std::map<std::string, util::StatsInfo<StrandInfo>> strand_stats;
+    std::map<std::string, util::StatsInfo<api::StrandInfo>> strand_stats;
     strand_stats["length"] = util::get_stats(strand_info_vec, [](const auto& a) { return a.length; }, ::param.sort_size);
     strand_stats["nsegs"] = util::get_stats(strand_info_vec, [](const auto& a) { return a.nsegs; }, ::param.sort_size);
     strand_stats["turning_angle_sum"] = util::get_stats(strand_info_vec, [](const auto& a) { return a.turning_angle_sum; }, ::param.sort_size);
@@ -288,11 +186,11 @@ std::shared_ptr<cyHairFile> cmd::exec::stats(std::shared_ptr<cyHairFile> hairfil
     strand_stats["max_point_curvature"] = util::get_stats(strand_info_vec, [](const auto& a) { return a.max_point_curvature; }, ::param.sort_size);
     strand_stats["min_point_curvature"] = util::get_stats(strand_info_vec, [](const auto& a) { return a.min_point_curvature; }, ::param.sort_size);
 
-    std::map<std::string, util::StatsInfo<SegmentInfo>> segment_stats;
+    std::map<std::string, util::StatsInfo<api::SegmentInfo>> segment_stats;
     segment_stats["length"] = util::get_stats(segment_info_vec, [](const auto& a) { return a.length; }, ::param.sort_size);
     segment_stats["turning_angle_diff"] = util::get_stats(segment_info_vec, [](const auto& a) { return a.turning_angle_diff; }, ::param.sort_size);
 
-    std::map<std::string, util::StatsInfo<PointInfo>> point_stats;
+    std::map<std::string, util::StatsInfo<api::PointInfo>> point_stats;
     point_stats["circumradius_reciprocal"] = util::get_stats(point_info_vec, [](const auto& a) { return a.circumradius_reciprocal; }, ::param.sort_size);
     point_stats["turning_angle"] = util::get_stats(point_info_vec, [](const auto& a) { return a.turning_angle; }, ::param.sort_size);
     point_stats["curvature"] = util::get_stats(point_info_vec, [](const auto& a) { return a.curvature; }, ::param.sort_size);
@@ -453,3 +351,84 @@ std::shared_ptr<cyHairFile> cmd::exec::stats(std::shared_ptr<cyHairFile> hairfil
 
     return {};
 }
+
+api::StatsResult api::stats(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in) {
+    const ContextScope scope(ctx);
+    const auto& header = hairfile_in->GetHeader();
+
+    // Every strand with n segments yields n segment items and max(n-1, 0) point items; lay them out up front
+    std::vector<size_t> segment_offsets(header.hair_count + 1, 0);
+    std::vector<size_t> point_offsets(header.hair_count + 1, 0);
+    for (unsigned int i = 0; i < header.hair_count; ++i) {
+        const unsigned int nsegs = header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? hairfile_in->GetSegmentsArray()[i] : header.d_segments;
+        segment_offsets[i + 1] = segment_offsets[i] + nsegs;
+        point_offsets[i + 1] = point_offsets[i] + (nsegs > 0 ? nsegs - 1 : 0);
+    }
+
+    StatsResult result;
+    std::vector<StrandInfo>& strand_info_vec = result.strands;
+    std::vector<SegmentInfo>& segment_info_vec = result.segments;
+    std::vector<PointInfo>& point_info_vec = result.points;
+    strand_info_vec.resize(header.hair_count);
+    segment_info_vec.resize(segment_offsets.back());
+    point_info_vec.resize(point_offsets.back());
+
+    // Collect raw data from per-segment and per-point geometry computed over the whole SoA buffers
+    log_info("Collecting raw data");
+    const Strands strands(*hairfile_in, false);
+    const aligned_vector<float> segment_lengths = strands.segment_lengths();
+    const Strands::Wedges wedges = strands.wedges(segment_lengths);
+    parallel::for_each_strand(strands.offsets, [&](unsigned int i, unsigned int offset, unsigned int nsegs) {
+        StrandInfo& strand_info = strand_info_vec[i];
+        strand_info.idx = i;
+        strand_info.nsegs = nsegs;
+
+        float prev_turning_angle;
+        for (unsigned int j = 0; j < nsegs; ++j) {
+            const float segment_length = segment_lengths[offset + j];
+
+            SegmentInfo& segment_info = segment_info_vec[segment_offsets[i] + j];
+            segment_info.idx = segment_offsets[i] + j;
+            segment_info.strand_idx = i;
+            segment_info.local_idx = j;
+            segment_info.length = segment_length;
+
+            if (j < nsegs - 1) {
+                // Wedge at the end point of the segment
+                const float circumradius_reciprocal = wedges.circumradius_reciprocal[offset + j + 1];
+                const float turning_angle = wedges.turning_angle[offset + j + 1];
+                const float curvature = wedges.curvature[offset + j + 1];
+
+                PointInfo& point_info = point_info_vec[point_offsets[i] + j];
+                point_info.idx = offset + j + 1;
+                point_info.strand_idx = i;
+                point_info.local_idx = j + 1;
+                point_info.circumradius_reciprocal = circumradius_reciprocal;
+                point_info.turning_angle = turning_angle;
+                point_info.curvature = curvature;
+
+                if (j > 0) {
+                    segment_info.turning_angle_diff = std::abs(turning_angle - prev_turning_angle);
+
+                    strand_info.max_segment_turning_angle_diff = std::max(strand_info.max_segment_turning_angle_diff, segment_info.turning_angle_diff);
+                    strand_info.min_segment_turning_angle_diff = std::min(strand_info.min_segment_turning_angle_diff, segment_info.turning_angle_diff);
+                }
+                prev_turning_angle = turning_angle;
+
+                strand_info.turning_angle_sum += turning_angle;
+
+                strand_info.max_point_circumradius_reciprocal = std::max(strand_info.max_point_circumradius_reciprocal, circumradius_reciprocal);
+                strand_info.min_point_circumradius_reciprocal = std::min(strand_info.min_point_circumradius_reciprocal, circumradius_reciprocal);
+                strand_info.max_point_turning_angle = std::max(strand_info.max_point_turning_angle, turning_angle);
+                strand_info.min_point_turning_angle = std::min(strand_info.min_point_turning_angle, turning_angle);
+                strand_info.max_point_curvature = std::max(strand_info.max_point_curvature, curvature);
+                strand_info.min_point_curvature = std::min(strand_info.min_point_curvature, curvature);
+            }
+
+            strand_info.length += segment_length;
+            strand_info.max_segment_length = std::max(strand_info.max_segment_length, segment_length);
+            strand_info.min_segment_length = std::min(strand_info.min_segment_length, segment_length);
+        }
+    });
+    return result;
+}
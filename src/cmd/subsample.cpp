@@ -6,7 +6,7 @@
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
     unsigned int& target_count = cmd::param::ui("subsample", "target_count");
     float& scale_factor = cmd::param::f("subsample", "scale_factor");
     std::set<int>& indices = cmd::param::set_i("subsample", "indices");
@@ -71,44 +71,89 @@ void cmd::parse::subsample(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::subsample(std::shared_ptr<cyHairFile> hairfile_in) {
+    CliContext ctx;
+    api::SubsampleResult result = api::subsample(ctx, hairfile_in, {
+        .target_count = ::param.target_count,
+        .scale_factor = ::param.scale_factor,
+        .indices = ::param.indices,
+        .exclude = ::param.exclude
+    });
+
+    if (::param.indices.empty() && ::param.output_indices) {
+        const std::string output_file_txt = util::path_under_optional_dir(fmt::format("{}_{}_indices.txt", globals::input_file_wo_ext, ::param.target_count), globals::output_dir);
+        if (!globals::overwrite && std::filesystem::exists(output_file_txt)) {
+            throw std::runtime_error("File already exists: " + output_file_txt + ". Use --overwrite to overwrite.");
+        }
+        log_info("Writing indices to {}", output_file_txt);
+        std::stringstream ss;
+        for (unsigned int i : result.indices)
+            ss << i << ",";
+        std::string s = ss.str().substr(0, ss.str().size() - 1);
+        std::ofstream ofs(output_file_txt);
+        ofs << s;
+    }
+
+    log_info("Selected {} strands", result.indices.size());
+    cmd::set_output_subset(std::move(result.subset));
+    return {};
+}
+
+api::SubsampleResult api::subsample(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in, const SubsampleOptions& options) {
+    const ContextScope scope(ctx);
     const auto& header_in = hairfile_in->GetHeader();
 
-    if (header_in.hair_count < ::param.target_count) {
+    if ((options.target_count == 0) == options.indices.empty()) {
+        throw std::runtime_error("Either target_count or indices (not both) must be given");
+    }
+    if (options.scale_factor >= 1.0) {
+        throw std::runtime_error("scale_factor must be less than 1.0");
+    }
+    if (header_in.hair_count < options.target_count) {
         throw std::runtime_error("Target number of hair strands must be less than the number of hair strands in the input file");
     }
 
     // Flag for whether a strand is selected
     std::vector<unsigned char> selected(header_in.hair_count, 0);
 
+    const std::vector<unsigned int>& in_offsets = hairfile_in->GetOffsetsArray();
+
     // Forward declare because of goto
     KdTree3d kdtree;
     AlignedBox3d bbox;
-    unsigned int in_point_offset;
     double r;
     UniformIntDistribution<int> uniform_dist(0, header_in.hair_count - 1);
+    Philox4x32 rng(ctx.seed, Philox4x32::hair_stream);
     unsigned int num_selected;
 
-    if (!::param.indices.empty()) {
+    const auto get_result = [&]{
+        SubsampleResult result;
+        for (unsigned int i = 0; i < header_in.hair_count; ++i) {
+            if (selected[i])
+                result.indices.push_back(i);
+        }
+        result.subset = HairSubset(hairfile_in, result.indices);
+        return result;
+    };
+
+    if (!options.indices.empty()) {
         for (unsigned int i = 0; i < header_in.hair_count; ++i) {
-            if (::param.indices.count(i)) {
+            if (options.indices.count(i)) {
                 selected[i] = 1;
             }
         }
-        if (::param.exclude) {
+        if (options.exclude) {
             for (unsigned int i = 0; i < header_in.hair_count; ++i) {
                 selected[i] = !selected[i];
             }
         }
-        return util::get_subset(hairfile_in, selected);
+        return get_result();
     }
 
     // Collect all the root points and build a kdtree
     kdtree.points.resize(header_in.hair_count, 3);
-    in_point_offset = 0;
     for (int i = 0; i < header_in.hair_count; ++i) {
-        Vector3d point = Map<Vector3f>(hairfile_in->GetPointsArray() + 3 * in_point_offset).cast<double>();
+        Vector3d point = Map<Vector3f>(hairfile_in->GetPointsArray() + 3 * in_offsets[i]).cast<double>();
         kdtree.points.row(i) = point.transpose();
-        in_point_offset += (hairfile_in->GetSegmentsArray() ? hairfile_in->GetSegmentsArray()[i] : header_in.d_segments) + 1;
     }
     kdtree.build();
 
@@ -120,7 +165,7 @@ std::shared_ptr<cyHairFile> cmd::exec::subsample(std::shared_ptr<cyHairFile> hai
     r = bbox.diagonal().norm() * 0.5;
 
     // Loop while the number of selected strands is below target
-    for ( ; (num_selected = std::accumulate(selected.begin(), selected.end(), 0)) < ::param.target_count; )
+    for ( ; (num_selected = std::accumulate(selected.begin(), selected.end(), 0)) < options.target_count; )
     {
         if (num_selected && num_selected % 100 == 0)
             log_info("Selected {} strands", num_selected);
@@ -145,33 +190,16 @@ std::shared_ptr<cyHairFile> cmd::exec::subsample(std::shared_ptr<cyHairFile> hai
         // If all points are covered, reduce the Poisson disk radius
         if (std::accumulate(covered.begin(), covered.end(), 0) == header_in.hair_count)
         {
-            r *= ::param.scale_factor;
+            r *= options.scale_factor;
         }
         else
         {
             // Randomly select one uncovered root point
-            int i = uniform_dist(globals::rng);                              // Start from a random point
+            int i = uniform_dist(rng);                                      // Start from a random point
             while (covered[i]) { i = (i + 1) % header_in.hair_count; }      // Find the first uncovered point
             selected[i] = 1;                                                // Flag it as selected
         }
     }
 
-    auto hairfile_out = util::get_subset(hairfile_in, selected);
-
-    if (::param.indices.empty() && ::param.output_indices) {
-        const std::string output_file_txt = util::path_under_optional_dir(fmt::format("{}_{}_indices.txt", globals::input_file_wo_ext, ::param.target_count), globals::output_dir);
-        if (!globals::overwrite && std::filesystem::exists(output_file_txt)) {
-            throw std::runtime_error("File already exists: " + output_file_txt + ". Use --overwrite to overwrite.");
-        }
-        log_info("Writing indices to {}", output_file_txt);
-        std::stringstream ss;
-        for (int i = 0; i < header_in.hair_count; ++i)
-            if (selected[i])
-                ss << i << ",";
-        std::string s = ss.str().substr(0, ss.str().size() - 1);
-        std::ofstream ofs(output_file_txt);
-        ofs << s;
-    }
-
-    return hairfile_out;
+    return get_result();
 }
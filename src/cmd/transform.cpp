@@ -1,10 +1,11 @@
 #include "cmd.h"
+#include "parallel.h"
 #include "util.h"
 
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
 std::string& s = cmd::param::s("transform", "s");
 std::string& t = cmd::param::s("transform", "t");
 std::string& r = cmd::param::s("transform", "r");
@@ -78,18 +79,28 @@ void cmd::parse::transform(args::Subparser &parser) {
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::transform(std::shared_ptr<cyHairFile> hairfile_in) {
-    unsigned int offset = 0;
-    for (unsigned int i = 0; i < hairfile_in->GetHeader().hair_count; ++i) {
-        const unsigned int segment_count = (hairfile_in->GetHeader().arrays & _CY_HAIR_FILE_SEGMENTS_BIT) ? hairfile_in->GetSegmentsArray()[i] : hairfile_in->GetHeader().d_segments;
+    CliContext ctx;
+    return api::transform(ctx, hairfile_in, { .M = ::param.M });
+}
+
+std::shared_ptr<cyHairFile> api::transform(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile_in, const TransformOptions& options) {
+    const ContextScope scope(ctx);
 
-        for (unsigned int j = 0; j < segment_count + 1; ++j) {
-            Map<Vector3f> point(hairfile_in->GetPointsArray() + 3 * (offset + j));
-            const Vector4f hpoint = (Vector4f() << point, 1).finished();
-            const Vector4f hpoint_new = ::param.M * hpoint;
-            point = hpoint_new.head(3) / hpoint_new(3);
+    // Every point is transformed independently: transform the points array in place, split by points rather than strands
+    parallel::for_range(hairfile_in->GetHeader().point_count, [&](size_t begin, size_t end) {
+        const Matrix4f M = options.M;       // Local copy, known not to alias the points
+        float* points = hairfile_in->GetPointsArray();
+        for (size_t i = begin; i < end; ++i) {
+            float* p = points + 3 * i;
+            const float w = M(3, 0) * p[0] + M(3, 1) * p[1] + M(3, 2) * p[2] + M(3, 3);
+            const float x_new = (M(0, 0) * p[0] + M(0, 1) * p[1] + M(0, 2) * p[2] + M(0, 3)) / w;
+            const float y_new = (M(1, 0) * p[0] + M(1, 1) * p[1] + M(1, 2) * p[2] + M(1, 3)) / w;
+            const float z_new = (M(2, 0) * p[0] + M(2, 1) * p[1] + M(2, 2) * p[2] + M(2, 3)) / w;
+            p[0] = x_new;
+            p[1] = y_new;
+            p[2] = z_new;
         }
-        offset += segment_count + 1;
-    }
+    });
 
     return hairfile_in;
 }
@@ -1,4 +1,5 @@
 #include "cmd.h"
+#include "parallel.h"
 #include "util.h"
 
 #include <happly.h>
@@ -6,7 +7,7 @@
 using namespace Eigen;
 
 namespace {
-struct {
+thread_local struct {
     float& radius = cmd::param::f("tubify", "radius");
     unsigned int& num_sides = cmd::param::ui("tubify", "num_sides");
     bool& capped = cmd::param::b("tubify", "capped");
@@ -35,6 +36,26 @@ void cmd::parse::tubify(args::Subparser &parser)
 }
 
 std::shared_ptr<cyHairFile> cmd::exec::tubify(std::shared_ptr<cyHairFile> hairfile) {
+    CliContext ctx;
+    api::TubifyResult result = api::tubify(ctx, hairfile, {
+        .radius = ::param.radius,
+        .num_sides = ::param.num_sides,
+        .capped = ::param.capped
+    });
+
+    happly::PLYData ply;
+    ply.addVertexPositions(result.vertex_xyz);
+    if (::param.colored)
+        ply.addVertexColors(result.vertex_rgb);
+    ply.addFaceIndices(result.faces);
+    const std::string output_file = util::path_under_optional_dir(globals::input_file_wo_ext + "_tube.ply", globals::output_dir);
+    ply.write(output_file, globals::ply_save_ascii ? happly::DataFormat::ASCII : happly::DataFormat::Binary);
+    log_info("Written to {}", output_file);
+    return {};
+}
+
+api::TubifyResult api::tubify(Context& ctx, const std::shared_ptr<cyHairFile>& hairfile, const TubifyOptions& options) {
+    const ContextScope scope(ctx);
     const auto& header = hairfile->GetHeader();
 
     std::vector<size_t> segments_array(header.hair_count, header.d_segments);
@@ -43,21 +64,30 @@ std::shared_ptr<cyHairFile> cmd::exec::tubify(std::shared_ptr<cyHairFile> hairfi
         segments_array[i] = hairfile->GetSegmentsArray()[i];
     }
 
-    const size_t total_num_vertices = header.point_count * ::param.num_sides;
-    const size_t total_num_segments = std::accumulate(segments_array.begin(), segments_array.end(), 0);
-    const size_t total_num_faces = ::param.num_sides * 2 * total_num_segments + (::param.capped ? 2 * header.hair_count : 0);
+    const size_t num_faces_per_segment = options.num_sides * 2;
+    const size_t num_faces_per_cap = options.capped ? 1 : 0;
+
+    // Face offset of each strand, so that strands can be filled independently
+    std::vector<size_t> face_offsets(header.hair_count + 1, 0);
+    for (unsigned int i = 0; i < header.hair_count; ++i)
+        face_offsets[i + 1] = face_offsets[i] + num_faces_per_segment * segments_array[i] + 2 * num_faces_per_cap;
 
-    std::vector<std::array<double, 3>> vertex_xyz;
-    std::vector<std::array<double, 3>> vertex_rgb;
-    std::vector<std::vector<uint32_t>> faces;
-    vertex_xyz.reserve(total_num_vertices);
-    vertex_rgb.reserve(total_num_vertices);
-    faces.reserve(total_num_faces);
-    size_t offset = 0;
-    std::uniform_real_distribution<float> dist(0, 1);
-    for (unsigned int i = 0; i < header.hair_count; ++i) {
-        const Vector3f random_color(dist(globals::rng), dist(globals::rng), dist(globals::rng));
-        const size_t num_segments = segments_array[i];
+    const size_t total_num_vertices = header.point_count * options.num_sides;
+    const size_t total_num_faces = face_offsets.back();
+
+    TubifyResult result;
+    std::vector<std::array<double, 3>>& vertex_xyz = result.vertex_xyz;
+    std::vector<std::array<double, 3>>& vertex_rgb = result.vertex_rgb;
+    std::vector<std::vector<uint32_t>>& faces = result.faces;
+    vertex_xyz.resize(total_num_vertices);
+    vertex_rgb.resize(total_num_vertices);
+    faces.resize(total_num_faces);
+    parallel::for_each_strand(*hairfile, [&](unsigned int i, size_t offset, size_t num_segments) {
+        Philox4x32 rng(ctx.seed, i);
+        std::uniform_real_distribution<float> dist(0, 1);
+        const Vector3f random_color(dist(rng), dist(rng), dist(rng));
+
+        size_t face_idx = face_offsets[i];
         Vector3f tangent;
         for (size_t j = 0; j <= num_segments; ++j) {
             const Vector3f center(&hairfile->GetPointsArray()[3 * (offset + j)]);
@@ -67,45 +97,34 @@ std::shared_ptr<cyHairFile> cmd::exec::tubify(std::shared_ptr<cyHairFile> hairfi
             Vector3f normal = tangent.tail(2).isZero() ? Vector3f::UnitY() : Vector3f::UnitX();
             normal = (normal - tangent * normal.dot(tangent)).normalized();
             const Vector3f binormal = tangent.cross(normal);
-            for (unsigned int k = 0; k < ::param.num_sides; ++k) {
-                const float theta = k * 2 * std::numbers::pi / ::param.num_sides;
-                const Vector3f pos = center + ::param.radius * (std::cos(theta) * normal + std::sin(theta) * binormal);
+            for (unsigned int k = 0; k < options.num_sides; ++k) {
+                const float theta = k * 2 * std::numbers::pi / options.num_sides;
+                const Vector3f pos = center + options.radius * (std::cos(theta) * normal + std::sin(theta) * binormal);
                 const Vector3f color = (header.arrays & _CY_HAIR_FILE_COLORS_BIT) ? Vector3f(&hairfile->GetColorsArray()[3 * (offset + j)]) : random_color;
-                vertex_xyz.push_back({});
-                vertex_rgb.push_back({});
-                util::copy_vec3(pos, vertex_xyz.back());
-                util::copy_vec3(color, vertex_rgb.back());
+                const size_t vertex_idx = options.num_sides * (offset + j) + k;
+                util::copy_vec3(pos, vertex_xyz[vertex_idx]);
+                util::copy_vec3(color, vertex_rgb[vertex_idx]);
                 if (j < num_segments) {
-                    const uint32_t fv0 = ::param.num_sides * (offset + j) + k;
-                    const uint32_t fv1 = ::param.num_sides * (offset + j) + (k + 1) % ::param.num_sides;
-                    const uint32_t fv2 = ::param.num_sides * (offset + j + 1) + (k + 1) % ::param.num_sides;
-                    const uint32_t fv3 = ::param.num_sides * (offset + j + 1) + k;
-                    faces.push_back({fv0, fv1, fv2});
-                    faces.push_back({fv2, fv3, fv0});
+                    const uint32_t fv0 = options.num_sides * (offset + j) + k;
+                    const uint32_t fv1 = options.num_sides * (offset + j) + (k + 1) % options.num_sides;
+                    const uint32_t fv2 = options.num_sides * (offset + j + 1) + (k + 1) % options.num_sides;
+                    const uint32_t fv3 = options.num_sides * (offset + j + 1) + k;
+                    faces[face_idx++] = {fv0, fv1, fv2};
+                    faces[face_idx++] = {fv2, fv3, fv0};
                 }
             }
         }
-        if (::param.capped) {
-            std::vector<uint32_t> cap_head(::param.num_sides);
-            std::vector<uint32_t> cap_tail(::param.num_sides);
-            for (unsigned int k = 0; k < ::param.num_sides; ++k) {
-                cap_head[k] = ::param.num_sides * offset + k;
-                cap_tail[k] = ::param.num_sides * (offset + num_segments) + k;
+        if (options.capped) {
+            std::vector<uint32_t> cap_head(options.num_sides);
+            std::vector<uint32_t> cap_tail(options.num_sides);
+            for (unsigned int k = 0; k < options.num_sides; ++k) {
+                cap_head[k] = options.num_sides * offset + k;
+                cap_tail[k] = options.num_sides * (offset + num_segments) + k;
             }
             std::reverse(cap_head.begin(), cap_head.end());
-            faces.push_back(cap_head);
-            faces.push_back(cap_tail);
+            faces[face_idx++] = std::move(cap_head);
+            faces[face_idx++] = std::move(cap_tail);
         }
-        offset += num_segments + 1;
-    }
-
-    happly::PLYData ply;
-    ply.addVertexPositions(vertex_xyz);
-    if (::param.colored)
-        ply.addVertexColors(vertex_rgb);
-    ply.addFaceIndices(faces);
-    const std::string output_file = util::path_under_optional_dir(globals::input_file_wo_ext + "_tube.ply", globals::output_dir);
-    ply.write(output_file, globals::ply_save_ascii ? happly::DataFormat::ASCII : happly::DataFormat::Binary);
-    log_info("Written to {}", output_file);
-    return {};
+    });
+    return result;
 }
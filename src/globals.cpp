@@ -1,3 +1,4 @@
+#include "api.h"
 #include "cmd.h"
 #include "io.h"
 
@@ -5,23 +6,50 @@ namespace globals {
     const float pi = std::acos(-1.0f);
     const float pi_2 = pi / 2.0f;
 
-    // Given as command line arguments
-    std::string input_file;
-    std::set<std::string> output_exts;
-    bool overwrite;
-    unsigned int ply_load_default_nsegs;
-    bool ply_save_ascii;
+    namespace {
+        State process_state;
+        thread_local State* thread_state = nullptr;      // Plain pointer, so that setting it does not bind the references below
+    }
+
+    State& state() {
+        return thread_state ? *thread_state : process_state;
+    }
+    void use_thread_state(State& state) {
+        thread_state = &state;
+    }
+    bool has_thread_state() {
+        return thread_state != nullptr;
+    }
+
+    thread_local std::string& input_file = state().input_file;
+    thread_local std::set<std::string>& output_exts = state().output_exts;
+    thread_local bool& overwrite = state().overwrite;
+    thread_local unsigned int& ply_load_default_nsegs = state().ply_load_default_nsegs;
+    thread_local bool& ply_save_ascii = state().ply_save_ascii;
+    thread_local bool& ply_save_minimal = state().ply_save_minimal;
+    thread_local float& hzc_error = state().hzc_error;
+    thread_local unsigned int& hzc_deflate_level = state().hzc_deflate_level;
+    thread_local std::vector<std::pair<unsigned int, unsigned int>>& strands = state().strands;
+    thread_local unsigned int& num_threads = state().num_threads;
 
-    // Other global variables
-    std::string input_file_wo_ext;
-    std::string input_ext;
-    OutputFile output_file_wo_ext;        // For lazy evaluation
-    std::string output_dir;
-    std::function<void(void)> check_error;
-    ::cmd::exec_func_t cmd_exec;
-    std::mt19937 rng;
-    nlohmann::json json;
+    thread_local std::string& input_file_wo_ext = state().input_file_wo_ext;
+    thread_local std::string& input_ext = state().input_ext;
+    thread_local OutputFile& output_file_wo_ext = state().output_file_wo_ext;
+    thread_local std::string& output_dir = state().output_dir;
+    thread_local std::function<void(void)>& check_error = state().check_error;
+    thread_local ::cmd::exec_func_t& cmd_exec = state().cmd_exec;
+    thread_local std::shared_ptr<const HairSubset>& output_subset = state().output_subset;
+    thread_local unsigned int& seed = state().seed;
+    thread_local nlohmann::json& json = state().json;
+    thread_local std::vector<double>& thread_busy_time = state().thread_busy_time;
 
+    std::mutex log_mutex;
+    std::mutex hdf5_mutex;
+    thread_local api::Context* context = nullptr;
+
+    nlohmann::json& log_json() {
+        return context ? context->log : json["log"];
+    }
 
     const std::unordered_map<std::string, std::pair<::io::load_func_t, ::io::save_func_t>> supported_ext = {
         {"bin", {::io::load_bin, ::io::save_bin}},
@@ -30,7 +58,9 @@ namespace globals {
         {"ply", {::io::load_ply, ::io::save_ply}},
         {"ma", {::io::load_ma, ::io::save_ma}},
         {"abc", {::io::load_abc, ::io::save_abc}},
-        {"npy", {::io::load_npy, ::io::save_npy}}
+        {"npy", {::io::load_npy, ::io::save_npy}},
+        {"hzc", {::io::load_hzc, ::io::save_hzc}},
+        {"h5", {::io::load_h5, ::io::save_h5}}
     };
 
     void clear() {
@@ -39,12 +69,19 @@ namespace globals {
         overwrite = {};
         ply_load_default_nsegs = {};
         ply_save_ascii = {};
+        ply_save_minimal = {};
+        hzc_error = State().hzc_error;
+        hzc_deflate_level = State().hzc_deflate_level;
+        strands = {};
+        num_threads = {};
         input_file_wo_ext = {};
         input_ext = {};
         output_file_wo_ext = OutputFile{};
         check_error = {};
         cmd_exec = nullptr;
-        rng = {};
+        output_subset = {};
+        seed = {};
         json = {};
+        thread_busy_time = {};
     }
 }
@@ -1,4 +1,5 @@
 #include "io.h"
+#include "parallel.h"
 
 #include <Alembic/AbcCoreFactory/All.h>
 #include <Alembic/AbcCoreOgawa/All.h>
@@ -7,7 +8,14 @@
 using namespace Alembic;
 
 namespace {
-void load_abc_sub(int depth, const Abc::IObject& obj, std::vector<float>& points, std::vector<unsigned short>& segments) {
+
+// Curves object with the transform from its space to the archive's, the product of the transforms of its ancestors
+struct CurvesObject {
+    Abc::IObject obj;
+    Abc::M44d matrix;
+};
+
+void load_abc_sub(int depth, const Abc::IObject& obj, const Abc::M44d& parent_matrix, std::vector<CurvesObject>& curves_objects) {
     const std::string spaces(depth * 2, ' ');
 
     std::string type = "unknown";
@@ -24,75 +32,110 @@ void load_abc_sub(int depth, const Abc::IObject& obj, std::vector<float>& points
 
     log_info("{}{} ({})", spaces, obj.getName(), type);
 
+    Abc::M44d matrix = parent_matrix;
     if (type == "transform") {
-        AbcGeom::IXformSchema xform(obj, Abc::kWrapExisting);
-        AbcGeom::IXformSchema::sample_type sample;
-        xform.get(sample);
+        AbcGeom::IXform xform(obj, Abc::kWrapExisting);
+        AbcGeom::XformSample sample;
+        xform.getSchema().get(sample);
 
-        if (sample.getNumOps() > 0) {
-            throw std::runtime_error("Transform is unsupported!");
-        }
+        // Points are row vectors, transformed by the object's matrix first
+        matrix = sample.getInheritsXforms() ? sample.getMatrix() * parent_matrix : sample.getMatrix();
     }
 
-    if (type == "curves") {
-        AbcGeom::ICurves curves(obj, Abc::kWrapExisting);
-        AbcGeom::ICurvesSchema::sample_type sample;
-        curves.getSchema().get(sample);
-
-        const size_t num_curves = sample.getNumCurves();
-        const size_t num_points = sample.getPositions()->size();
-
-        log_info("{}  num curves: {}", spaces, num_curves);
-        log_info("{}  num points: {}", spaces, num_points);
-
-        // Copy segments data
-        segments.reserve(segments.size() + num_curves);
-        int num_points_check = 0;
-        for (size_t i = 0; i < num_curves; ++i) {
-            segments.push_back((*sample.getCurvesNumVertices())[i] - 1);
-            num_points_check += (*sample.getCurvesNumVertices())[i];
-        }
-
-        if (num_points_check != num_points) {
-            throw std::runtime_error(fmt::format("Sum of curvesNumVertices does not match number of points! {} vs {}", num_points_check, num_points));
-        }
-
-        // Copy points data
-        std::vector<float> new_points(num_points * 3);
-        for (size_t i = 0; i < num_points; ++i) {
-            std::memcpy(new_points.data() + 3*i, &sample.getPositions()->get()[i].x, 3*sizeof(float));
-        }
-        points.insert(points.end(), new_points.begin(), new_points.end());
-    }
+    if (type == "curves")
+        curves_objects.push_back({ obj, matrix });
 
     for (size_t i = 0; i < obj.getNumChildren(); i++) {
-        load_abc_sub(depth + 1, obj.getChild(i), points, segments);
+        load_abc_sub(depth + 1, obj.getChild(i), matrix, curves_objects);
     }
 }
 }
 
 std::shared_ptr<cyHairFile> io::load_abc(const std::string &filename) {
+    // Ogawa archives can be read from several threads at once, each with a stream of its own
     AbcCoreFactory::IFactory factory;
+    factory.setOgawaNumStreams(parallel::num_threads());
     Abc::IArchive archive = factory.getArchive(filename);
 
     if (!archive.valid()) {
         throw std::runtime_error(fmt::format("Failed to open Alembic file \"{}\"", filename));
     }
 
-    std::vector<float> points;
-    std::vector<unsigned short> segments;
+    // Find the curves objects recursively
+    std::vector<CurvesObject> curves_objects;
+    load_abc_sub(0, archive.getTop(), Abc::M44d(), curves_objects);
 
-    // Read data recursively
-    load_abc_sub(0, archive.getTop(), points, segments);
+    // Read the number of vertices of every curve, objects in parallel, to allocate the arrays once
+    std::vector<Abc::Int32ArraySamplePtr> num_vertices(curves_objects.size());
+    parallel::for_range(curves_objects.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            AbcGeom::ICurves curves(curves_objects[k].obj, Abc::kWrapExisting);
+            curves.getSchema().getNumVerticesProperty().get(num_vertices[k]);
+        }
+    });
+
+    // Strand and point offsets of every object
+    std::vector<size_t> hair_offsets = { 0 };
+    std::vector<size_t> point_offsets = { 0 };
+    for (size_t k = 0; k < curves_objects.size(); ++k) {
+        const size_t num_curves = num_vertices[k]->size();
+        size_t num_points = 0;
+        for (size_t i = 0; i < num_curves; ++i) {
+            if ((*num_vertices[k])[i] < 1 || (*num_vertices[k])[i] - 1 > std::numeric_limits<unsigned short>::max()) {
+                throw std::runtime_error(fmt::format("Invalid number of vertices of curve {} of {}: {}", i, curves_objects[k].obj.getFullName(), (*num_vertices[k])[i]));
+            }
+            num_points += (*num_vertices[k])[i];
+        }
+        log_info("{}", curves_objects[k].obj.getFullName());
+        log_info("  num curves: {}", num_curves);
+        log_info("  num points: {}", num_points);
+        hair_offsets.push_back(hair_offsets.back() + num_curves);
+        point_offsets.push_back(point_offsets.back() + num_points);
+    }
 
     std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
 
     hairfile->SetArrays(_CY_HAIR_FILE_POINTS_BIT | _CY_HAIR_FILE_SEGMENTS_BIT);
-    hairfile->SetHairCount(segments.size());
-    hairfile->SetPointCount(points.size() / 3);
-
-    std::memcpy(hairfile->GetPointsArray(), points.data(), points.size() * sizeof(float));
-    std::memcpy(hairfile->GetSegmentsArray(), segments.data(), segments.size() * sizeof(unsigned short));
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+
+    // Read the positions of every object, objects in parallel
+    std::vector<Abc::P3fArraySamplePtr> positions(curves_objects.size());
+    parallel::for_range(curves_objects.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            AbcGeom::ICurves curves(curves_objects[k].obj, Abc::kWrapExisting);
+            curves.getSchema().getPositionsProperty().get(positions[k]);
+
+            const size_t num_points = point_offsets[k + 1] - point_offsets[k];
+            if (positions[k]->size() != num_points) {
+                throw std::runtime_error(fmt::format("Sum of curvesNumVertices does not match number of points! {} vs {}", num_points, positions[k]->size()));
+            }
+
+            for (size_t i = 0; i < num_vertices[k]->size(); ++i)
+                hairfile->GetSegmentsArray()[hair_offsets[k] + i] = (*num_vertices[k])[i] - 1;
+        }
+    });
+
+    // Transform the positions of every object into its place in the points array, points in parallel so that a single large object is split too
+    for (size_t k = 0; k < curves_objects.size(); ++k) {
+        const Abc::V3f* positions_k = positions[k]->get();
+        float* points = hairfile->GetPointsArray() + 3 * point_offsets[k];
+        const Abc::M44d& matrix = curves_objects[k].matrix;
+        const bool identity = matrix == Abc::M44d();
+        parallel::for_range(point_offsets[k + 1] - point_offsets[k], [&](size_t begin, size_t end) {
+            if (identity) {
+                std::memcpy(points + 3 * begin, positions_k + begin, (end - begin) * 3 * sizeof(float));
+                return;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                Abc::V3d p;
+                matrix.multVecMatrix(Abc::V3d(positions_k[i]), p);
+                points[3 * i + 0] = p.x;
+                points[3 * i + 1] = p.y;
+                points[3 * i + 2] = p.z;
+            }
+        });
+    }
 
     return hairfile;
 }
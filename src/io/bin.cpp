@@ -5,93 +5,159 @@ File format used in:
 */
 
 #include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
 
 std::shared_ptr<cyHairFile> io::load_bin(const std::string &filename) {
-    std::ifstream ifs;
-    ifs.open(filename.c_str(), std::ios_base::binary);
+    const MappedFile file(filename);
 
-    if (!ifs.is_open()) {
-        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
-    }
-
-    // Read the number of strands
-    int hair_count;
-    ifs.read((char*)&hair_count, sizeof(int));
+    // Size of a point: xyz followed by 4 unused floats
+    const size_t point_size = 7 * sizeof(float);
 
-    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
-
-    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
-    hairfile->SetHairCount(hair_count);
-
-    std::vector<float> points_array;
-    points_array.reserve(hair_count * 3 * 1000);
+    // Read the number of strands, each of which takes at least its number of points
+    const int hair_count = file.read<int>(0);
+    if (hair_count < 0) {
+        throw std::runtime_error(fmt::format("Invalid number of strands in {}: {}", filename, hair_count));
+    }
+    file.check_range(sizeof(int), size_t(hair_count) * sizeof(int));
 
+    // First pass: hop from one strand header to the next to get the number of points in every strand
+    std::vector<unsigned short> segments_array(hair_count);
+    size_t pos = sizeof(int);
+    size_t point_count = 0;
     for (int hair_idx = 0; hair_idx < hair_count; ++hair_idx) {
-        if (hair_idx > 0 && hair_idx % 100 == 0)
-            spdlog::trace("Processing hair {}/{}", hair_idx, hair_count);
-
-        // Read the number of points in the strand
-        int num_points;
-        ifs.read((char*)&num_points, sizeof(int));
-        assert(num_points < 0x10000);
-
-        hairfile->GetSegmentsArray()[hair_idx] = num_points - 1;
-
-        // Read individual points
-        for (int j = 0; j < num_points; ++j) {
-            float x, y, z;
-            ifs.read((char*)&x, sizeof(float));     points_array.push_back(x);
-            ifs.read((char*)&y, sizeof(float));     points_array.push_back(y);
-            ifs.read((char*)&z, sizeof(float));     points_array.push_back(z);
-
-            float dummy;
-            for (int k = 0; k < 4; ++k)
-                ifs.read((char*)&dummy, sizeof(float));
+        const int num_points = file.read<int>(pos);
+        if (num_points < 1 || num_points - 1 > std::numeric_limits<unsigned short>::max()) {
+            throw std::runtime_error(fmt::format("Invalid number of points of strand {} in {}: {}", hair_idx, filename, num_points));
         }
+        pos += sizeof(int);
+        file.check_range(pos, num_points * point_size);
+        pos += num_points * point_size;
+
+        segments_array[hair_idx] = num_points - 1;
+        point_count += num_points;
+    }
+    if (point_count > std::numeric_limits<unsigned int>::max()) {
+        throw std::runtime_error(fmt::format("Invalid number of points in {}: {}", filename, point_count));
     }
 
-    // Copy content of points_array to hairfile->GetPointsArray()
-    hairfile->SetPointCount(points_array.size() / 3);
-    std::memcpy(hairfile->GetPointsArray(), points_array.data(), points_array.size() * sizeof(float));
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(hair_count);
+    hairfile->SetPointCount(point_count);
+    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
+    std::copy(segments_array.begin(), segments_array.end(), hairfile->GetSegmentsArray());
+
+    // Second pass: gather xyz of every point into the points array, strands in parallel.
+    // Strand i starts after the strand count, i + 1 point counts and the points of the strands before it.
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+    parallel::for_each_strand(offsets, [&](unsigned int hair_idx, size_t offset, size_t num_segments) {
+        const char* src = file.data() + sizeof(int) * (hair_idx + 2) + point_size * offset;
+        float* dst = hairfile->GetPointsArray() + 3 * offset;
+        for (size_t j = 0; j <= num_segments; ++j)
+            std::memcpy(dst + 3 * j, src + point_size * j, 3 * sizeof(float));
+    });
 
     return hairfile;
 }
 
-void io::save_bin(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
-    std::ofstream ofs;
-    ofs.open(filename.c_str(), std::ios::out | std::ios::binary);
+std::shared_ptr<cyHairFile> io::load_bin_subset(const std::string &filename, const strand_ranges_t &ranges) {
+    const RandomAccessFile file(filename);
+    // Size of a point: xyz followed by 4 unused floats
+    const size_t point_size = 7 * sizeof(float);
 
-    if (!ofs.is_open()) {
-        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    const int hair_count = file.read<int>(0);
+    if (hair_count < 0) {
+        throw std::runtime_error(fmt::format("Invalid number of strands in {}: {}", filename, hair_count));
+    }
+    check_strand_ranges(ranges, hair_count, filename);
+
+    // Hop from one strand header to the next, up to the last strand to load, to find the position and the point offset of every strand
+    unsigned int scan_end = 0;
+    for (const auto& [begin, end] : ranges)
+        scan_end = std::max(scan_end, end);
+    std::vector<size_t> positions = { sizeof(int) };
+    std::vector<unsigned int> offsets = { 0 };
+    for (unsigned int hair_idx = 0; hair_idx < scan_end; ++hair_idx) {
+        const int num_points = file.read<int>(positions.back());
+        if (num_points < 1 || num_points - 1 > std::numeric_limits<unsigned short>::max()) {
+            throw std::runtime_error(fmt::format("Invalid number of points of strand {} in {}: {}", hair_idx, filename, num_points));
+        }
+        if (offsets.back() + size_t(num_points) > std::numeric_limits<unsigned int>::max()) {
+            throw std::runtime_error(fmt::format("Invalid number of points in {}: {}", filename, offsets.back() + size_t(num_points)));
+        }
+        positions.push_back(positions.back() + sizeof(int) + num_points * point_size);
+        offsets.push_back(offsets.back() + num_points);
     }
 
-    const auto& header = hairfile->GetHeader();
-
-    // Write the number of strands
-    ofs.write((char*)&header.hair_count, sizeof(int));
+    // Strand and point offsets of every range in the loaded hair
+    std::vector<unsigned int> hair_offsets = { 0 };
+    std::vector<unsigned int> point_offsets = { 0 };
+    for (const auto& [begin, end] : ranges) {
+        if (point_offsets.back() + size_t(offsets[end] - offsets[begin]) > std::numeric_limits<unsigned int>::max()) {
+            throw std::runtime_error(fmt::format("Too many points to load from {}", filename));
+        }
+        hair_offsets.push_back(hair_offsets.back() + end - begin);
+        point_offsets.push_back(point_offsets.back() + offsets[end] - offsets[begin]);
+    }
 
-    float* points_ptr = hairfile->GetPointsArray();
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
 
-    for (int hair_idx = 0; hair_idx < header.hair_count; ++hair_idx) {
-        if (hair_idx > 0 && hair_idx % 100 == 0)
-            spdlog::trace("Processing hair {}/{}", hair_idx, header.hair_count);
+    // Read the records of the strands of every range in blocks of about 16MB and gather their points, ranges in parallel
+    const size_t block_size = 16 << 20;
+    parallel::for_range(ranges.size(), [&](size_t range_begin, size_t range_end) {
+        std::vector<char> buffer;
+        for (size_t r = range_begin; r < range_end; ++r) {
+            const auto [begin, end] = ranges[r];
+            for (unsigned int block_begin = begin; block_begin < end; ) {
+                unsigned int block_end = block_begin + 1;
+                while (block_end < end && positions[block_end + 1] - positions[block_begin] <= block_size)
+                    ++block_end;
+                buffer.resize(positions[block_end] - positions[block_begin]);
+                file.read(positions[block_begin], buffer.size(), buffer.data());
+
+                for (unsigned int i = block_begin; i < block_end; ++i) {
+                    const unsigned int k = hair_offsets[r] + i - begin;
+                    hairfile->GetSegmentsArray()[k] = offsets[i + 1] - offsets[i] - 1;
+                    const char* src = buffer.data() + positions[i] - positions[block_begin] + sizeof(int);
+                    float* dst = hairfile->GetPointsArray() + 3 * (point_offsets[r] + offsets[i] - offsets[begin]);
+                    for (unsigned int j = 0; j < offsets[i + 1] - offsets[i]; ++j)
+                        std::memcpy(dst + 3 * j, src + point_size * j, 3 * sizeof(float));
+                }
+                block_begin = block_end;
+            }
+        }
+    });
 
-        // Write the number of points in the strand
-        int num_points = (hairfile->GetSegmentsArray() ? hairfile->GetSegmentsArray()[hair_idx] : header.d_segments) + 1;
-        ofs.write((char*)&num_points, sizeof(int));
+    return hairfile;
+}
 
-        // Write individual points
-        for (int j = 0; j < num_points; j++) {
-            const float x = *points_ptr++;
-            const float y = *points_ptr++;
-            const float z = *points_ptr++;
-            ofs.write((char*)&x, sizeof(float));
-            ofs.write((char*)&y, sizeof(float));
-            ofs.write((char*)&z, sizeof(float));
+void io::save_bin(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
+    save_bin_subset(filename, HairSubset(hairfile));
+}
 
-            const float dummy = 0;
-            for (int k = 0; k < 4; ++k)
-                ofs.write((char*)&dummy, sizeof(float));
+void io::save_bin_subset(const std::string &filename, const HairSubset &subset) {
+    const unsigned int hair_count = subset.hair_count();
+
+    // Strand records (point count followed by xyz and 4 unused zero floats for every point) have sizes known from the point offsets,
+    // so the file is allocated at its final size and the records are filled in place, strands in parallel.
+    // Strand i starts after the strand count, i point counts and the points of the strands before it.
+    const size_t point_size = 7 * sizeof(float);
+    MappedOutputFile file(filename, sizeof(int) * (hair_count + 1) + point_size * subset.point_count());
+    std::memcpy(file.data(), &hair_count, sizeof(int));
+
+    parallel::for_each_strand(subset.offsets, [&](unsigned int hair_idx, size_t offset, size_t num_segments) {
+        const int num_points = num_segments + 1;
+        char* dst = file.data() + sizeof(int) * (hair_idx + 1) + point_size * offset;
+        std::memcpy(dst, &num_points, sizeof(int));
+        dst += sizeof(int);
+        const float* src = subset.base->GetPointsArray() + 3 * subset.base_offset(hair_idx);
+        for (int j = 0; j < num_points; ++j) {
+            std::memcpy(dst + point_size * j, src + 3 * j, 3 * sizeof(float));
+            std::memset(dst + point_size * j + 3 * sizeof(float), 0, 4 * sizeof(float));
         }
-    }
+    });
+    file.commit();
 }
@@ -0,0 +1,189 @@
+/*
+HDF5 layout:
+    /offsets        (hair_count + 1) uint32: point offset of every strand, then the point count
+    /segments       (hair_count) uint16
+    /points         (point_count, 3) float
+    /thickness      (point_count) float, if the hair has thickness
+    /transparency   (point_count) float, if the hair has transparency
+    /colors         (point_count, 3) float, if the hair has colors
+with the defaults of the hair as attributes of the root group. Datasets are chunked and compressed (shuffle + deflate),
+so that strand i, which is points[offsets[i]:offsets[i+1]], can be read with a hyperslab without reading the rest.
+All HDF5 calls are made under globals::hdf5_mutex, as the bundled HDF5 is not thread-safe and batch mode loads and saves
+files concurrently.
+*/
+
+#include "io.h"
+
+#include <highfive/H5File.hpp>
+
+namespace {
+
+// Rows per chunk of the datasets
+const size_t chunk_rows = 64 * 1024;
+const unsigned int deflate_level = 6;
+
+// Per-point datasets with their array and number of components
+const std::array<std::tuple<const char*, unsigned int, unsigned int>, 4> point_datasets = {{
+    { "points", _CY_HAIR_FILE_POINTS_BIT, 3 },
+    { "thickness", _CY_HAIR_FILE_THICKNESS_BIT, 1 },
+    { "transparency", _CY_HAIR_FILE_TRANSPARENCY_BIT, 1 },
+    { "colors", _CY_HAIR_FILE_COLORS_BIT, 3 },
+}};
+
+template <class T>
+void write_dataset(HighFive::File& file, const std::string& name, const T* data, size_t count, unsigned int dim) {
+    const std::vector<size_t> dims = dim == 1 ? std::vector<size_t>{ count } : std::vector<size_t>{ count, dim };
+
+    // Empty datasets cannot be chunked
+    HighFive::DataSetCreateProps props;
+    if (count > 0) {
+        std::vector<hsize_t> chunk_dims(dims.begin(), dims.end());
+        chunk_dims[0] = std::min(count, chunk_rows);
+        props.add(HighFive::Chunking(chunk_dims));
+        if (H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0) {
+            props.add(HighFive::Shuffle());
+            props.add(HighFive::Deflate(deflate_level));
+        }
+    }
+    HighFive::DataSet dataset = file.createDataSet<T>(name, HighFive::DataSpace(dims), props);
+    if (count > 0)
+        dataset.write_raw(data);
+}
+
+// Rows [begin, begin + count) of a dataset of rows of dim components
+template <class T>
+void read_rows(const HighFive::DataSet& dataset, size_t begin, size_t count, unsigned int dim, T* data) {
+    const std::vector<size_t> dims = dataset.getDimensions();
+    if (dims.size() != (dim == 1 ? 1 : 2) || (dim > 1 && dims[1] != dim) || begin + count > dims[0]) {
+        throw std::runtime_error(fmt::format("Invalid HDF5 dataset {}: expected at least {} rows of {} components", dataset.getPath(), begin + count, dim));
+    }
+    if (count == 0)
+        return;
+    std::vector<size_t> offset = { begin }, size = { count };
+    if (dim > 1) {
+        offset.push_back(0);
+        size.push_back(dim);
+    }
+    dataset.select(offset, size).read_raw(data);
+}
+
+// Number of strands of the file, from the size of its offsets dataset
+unsigned int read_hair_count(const HighFive::File& file, const std::string& filename) {
+    const std::vector<size_t> dims = file.getDataSet("offsets").getDimensions();
+    if (dims.size() != 1 || dims[0] < 1) {
+        throw std::runtime_error(fmt::format("Invalid HDF5 hair file {}: offsets must be a nonempty 1D array", filename));
+    }
+    return dims[0] - 1;
+}
+
+// Strands in the given ranges of the file of hair_count strands
+std::shared_ptr<cyHairFile> load_strands(const HighFive::File& file, const std::string& filename, unsigned int hair_count, const io::strand_ranges_t& ranges) {
+    io::check_strand_ranges(ranges, hair_count, filename);
+    const HighFive::DataSet offsets_dataset = file.getDataSet("offsets");
+
+    // Point offsets of strands [begin, end] of every range, and strand and point offsets of every range in the loaded hair
+    std::vector<std::vector<unsigned int>> offsets(ranges.size());
+    std::vector<unsigned int> hair_offsets = { 0 };
+    std::vector<unsigned int> point_offsets = { 0 };
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const auto [begin, end] = ranges[r];
+        offsets[r].resize(end - begin + 1);
+        read_rows(offsets_dataset, begin, offsets[r].size(), 1, offsets[r].data());
+        hair_offsets.push_back(hair_offsets.back() + end - begin);
+        point_offsets.push_back(point_offsets.back() + offsets[r].back() - offsets[r].front());
+    }
+
+    if (!file.exist("points")) {
+        throw std::runtime_error(fmt::format("Invalid HDF5 hair file {}: no points dataset", filename));
+    }
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    unsigned int arrays = _CY_HAIR_FILE_SEGMENTS_BIT;
+    for (const auto& [name, bit, dim] : point_datasets) {
+        if (file.exist(name))
+            arrays |= bit;
+    }
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+    hairfile->SetArrays(arrays);
+
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        for (unsigned int i = 0; i + 1 < offsets[r].size(); ++i) {
+            if (offsets[r][i + 1] <= offsets[r][i] || offsets[r][i + 1] - offsets[r][i] - 1 > std::numeric_limits<unsigned short>::max()) {
+                throw std::runtime_error(fmt::format("Invalid strand offsets in {}: strand {} has {} points", filename, ranges[r].first + i, int64_t(offsets[r][i + 1]) - offsets[r][i]));
+            }
+            hairfile->GetSegmentsArray()[hair_offsets[r] + i] = offsets[r][i + 1] - offsets[r][i] - 1;
+        }
+    }
+    // One hyperslab per range, HDF5 decompressing only the chunks it overlaps
+    for (const auto& [name, bit, dim] : point_datasets) {
+        if (!(arrays & bit))
+            continue;
+        const HighFive::DataSet dataset = file.getDataSet(name);
+        for (size_t r = 0; r < ranges.size(); ++r)
+            read_rows(dataset, offsets[r].front(), offsets[r].back() - offsets[r].front(), dim, io::get_array(*hairfile, bit) + size_t(dim) * point_offsets[r]);
+    }
+
+    if (file.hasAttribute("default_segments")) {
+        unsigned int d_segments;
+        file.getAttribute("default_segments").read(d_segments);
+        hairfile->SetDefaultSegmentCount(d_segments);
+    }
+    if (file.hasAttribute("default_thickness")) {
+        float d_thickness;
+        file.getAttribute("default_thickness").read(d_thickness);
+        hairfile->SetDefaultThickness(d_thickness);
+    }
+    if (file.hasAttribute("default_transparency")) {
+        float d_transparency;
+        file.getAttribute("default_transparency").read(d_transparency);
+        hairfile->SetDefaultTransparency(d_transparency);
+    }
+    if (file.hasAttribute("default_color")) {
+        std::vector<float> d_color;
+        file.getAttribute("default_color").read(d_color);
+        if (d_color.size() == 3)
+            hairfile->SetDefaultColor(d_color[0], d_color[1], d_color[2]);
+    }
+
+    return hairfile;
+}
+
+}
+
+std::shared_ptr<cyHairFile> io::load_h5(const std::string &filename) {
+    const std::lock_guard<std::mutex> lock(globals::hdf5_mutex);
+    const HighFive::File file(filename, HighFive::File::ReadOnly);
+    const unsigned int hair_count = read_hair_count(file, filename);
+    return load_strands(file, filename, hair_count, {{ 0, hair_count }});
+}
+
+std::shared_ptr<cyHairFile> io::load_h5_subset(const std::string &filename, const strand_ranges_t &ranges) {
+    const std::lock_guard<std::mutex> lock(globals::hdf5_mutex);
+    const HighFive::File file(filename, HighFive::File::ReadOnly);
+    return load_strands(file, filename, read_hair_count(file, filename), ranges);
+}
+
+void io::save_h5(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
+    const auto& header = hairfile->GetHeader();
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+
+    const std::lock_guard<std::mutex> lock(globals::hdf5_mutex);
+    HighFive::File file(filename, HighFive::File::Overwrite);
+
+    std::vector<unsigned short> segments(header.hair_count);
+    for (unsigned int i = 0; i < header.hair_count; ++i)
+        segments[i] = offsets[i + 1] - offsets[i] - 1;
+    write_dataset(file, "offsets", offsets.data(), offsets.size(), 1);
+    write_dataset(file, "segments", segments.data(), segments.size(), 1);
+    for (const auto& [name, bit, dim] : point_datasets) {
+        if (header.arrays & bit)
+            write_dataset(file, name, get_array(*hairfile, bit), header.point_count, dim);
+    }
+
+    const unsigned int d_segments = header.d_segments;
+    const std::vector<float> d_color(header.d_color, header.d_color + 3);
+    file.createAttribute<unsigned int>("default_segments", HighFive::DataSpace::From(d_segments)).write(d_segments);
+    file.createAttribute<float>("default_thickness", HighFive::DataSpace::From(header.d_thickness)).write(header.d_thickness);
+    file.createAttribute<float>("default_transparency", HighFive::DataSpace::From(header.d_transparency)).write(header.d_transparency);
+    file.createAttribute<float>("default_color", HighFive::DataSpace::From(d_color)).write(d_color);
+}
@@ -5,8 +5,64 @@ File format used in:
 */
 
 #include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+namespace {
+
+// Point the arrays of a hair into a copy-on-write mapping of a HAIR file, or nullptr if the file cannot be used in place
+// (not a valid HAIR file, which is left to cyHairFile::LoadFromFile to report, or arrays not aligned for their type)
+std::shared_ptr<cyHairFile> map_hair(const std::string &filename) {
+    std::shared_ptr<MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(filename, true);
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+    if (file->size() < sizeof(cyHairFile::Header))
+        return nullptr;
+    const auto header = file->read<cyHairFile::Header>(0);
+    if (std::strncmp(header.signature, "HAIR", 4) != 0)
+        return nullptr;
+
+    // Arrays follow the header back to back, in this order
+    size_t pos = sizeof(cyHairFile::Header);
+    const auto next_array = [&](unsigned int bit, size_t count, size_t element_size) -> char* {
+        if (!(header.arrays & bit))
+            return nullptr;
+        char* array = file->mutable_data() + pos;
+        pos += count * element_size;
+        return array;
+    };
+    const auto segments = next_array(_CY_HAIR_FILE_SEGMENTS_BIT, header.hair_count, sizeof(unsigned short));
+    const auto points = next_array(_CY_HAIR_FILE_POINTS_BIT, 3 * size_t(header.point_count), sizeof(float));
+    const auto thickness = next_array(_CY_HAIR_FILE_THICKNESS_BIT, header.point_count, sizeof(float));
+    const auto transparency = next_array(_CY_HAIR_FILE_TRANSPARENCY_BIT, header.point_count, sizeof(float));
+    const auto colors = next_array(_CY_HAIR_FILE_COLORS_BIT, 3 * size_t(header.point_count), sizeof(float));
+    if (pos > file->size())
+        return nullptr;
+
+    // The float arrays all start at the same offset modulo 4, depending on the size of the segments array
+    const size_t float_arrays_offset = sizeof(cyHairFile::Header) + (segments ? header.hair_count * sizeof(unsigned short) : 0);
+    if (float_arrays_offset % alignof(float) != 0) {
+        log_debug("Cannot map {} in place, its arrays not being aligned", filename);
+        return nullptr;
+    }
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetExternalArrays(header, file, reinterpret_cast<unsigned short*>(segments),
+        reinterpret_cast<float*>(points), reinterpret_cast<float*>(thickness), reinterpret_cast<float*>(transparency), reinterpret_cast<float*>(colors));
+    return hairfile;
+}
+
+}
 
 std::shared_ptr<cyHairFile> io::load_hair(const std::string &filename) {
+    // Zero-copy load when possible: pages are read when first accessed and shared with other processes mapping the file,
+    // and commands modifying the hair only copy the pages they write
+    if (std::shared_ptr<cyHairFile> hairfile = map_hair(filename))
+        return hairfile;
+
     std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
 
     int res = hairfile->LoadFromFile(filename.c_str());
@@ -29,6 +85,102 @@ std::shared_ptr<cyHairFile> io::load_hair(const std::string &filename) {
     return hairfile;
 }
 
+std::shared_ptr<cyHairFile> io::load_hair_subset(const std::string &filename, const strand_ranges_t &ranges) {
+    const RandomAccessFile file(filename);
+    const auto header = file.read<cyHairFile::Header>(0);
+    if (std::strncmp(header.signature, "HAIR", 4) != 0) {
+        throw std::runtime_error(fmt::format("Error while loading {}: wrong signature", filename));
+    }
+    check_strand_ranges(ranges, header.hair_count, filename);
+
+    // Point offsets of all strands, from the segments array if any
+    std::vector<unsigned short> segments(header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? header.hair_count : 0);
+    file.read(sizeof(cyHairFile::Header), segments.size() * sizeof(unsigned short), segments.data());
+    std::vector<unsigned int> offsets(header.hair_count + 1);
+    for (unsigned int i = 0; i < header.hair_count; ++i)
+        offsets[i + 1] = offsets[i] + (segments.empty() ? header.d_segments : segments[i]) + 1;
+    if (offsets.back() != header.point_count) {
+        throw std::runtime_error(fmt::format("Error while loading {}: segments add up to {} points instead of {}", filename, offsets.back(), header.point_count));
+    }
+
+    // Strand and point offsets of every range in the loaded hair
+    std::vector<unsigned int> hair_offsets = { 0 };
+    std::vector<unsigned int> point_offsets = { 0 };
+    for (const auto& [begin, end] : ranges) {
+        hair_offsets.push_back(hair_offsets.back() + end - begin);
+        point_offsets.push_back(point_offsets.back() + offsets[end] - offsets[begin]);
+    }
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    std::memcpy((void*)&hairfile->GetHeader(), &header, sizeof(cyHairFile::Header));
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+    hairfile->SetArrays(header.arrays);
+    for (size_t r = 0; !segments.empty() && r < ranges.size(); ++r)
+        std::copy(segments.begin() + ranges[r].first, segments.begin() + ranges[r].second, hairfile->GetSegmentsArray() + hair_offsets[r]);
+
+    // Read the points of every range from each per-point array, which follow the segments array back to back
+    size_t pos = sizeof(cyHairFile::Header) + segments.size() * sizeof(unsigned short);
+    for (const auto& [bit, dim] : { std::pair{ _CY_HAIR_FILE_POINTS_BIT, 3 }, { _CY_HAIR_FILE_THICKNESS_BIT, 1 }, { _CY_HAIR_FILE_TRANSPARENCY_BIT, 1 }, { _CY_HAIR_FILE_COLORS_BIT, 3 } }) {
+        if (!(header.arrays & bit))
+            continue;
+        float* array = get_array(*hairfile, bit);
+        parallel::for_range(ranges.size(), [&](size_t range_begin, size_t range_end) {
+            for (size_t r = range_begin; r < range_end; ++r) {
+                const auto [begin, end] = ranges[r];
+                file.read(pos + dim * sizeof(float) * offsets[begin], dim * sizeof(float) * (offsets[end] - offsets[begin]), array + dim * point_offsets[r]);
+            }
+        });
+        pos += dim * sizeof(float) * header.point_count;
+    }
+
+    return hairfile;
+}
+
 void io::save_hair(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
-    hairfile->SaveToFile(filename.c_str());
+    save_hair_subset(filename, HairSubset(hairfile));
+}
+
+void io::save_hair_subset(const std::string &filename, const HairSubset &subset) {
+    const cyHairFile::Header header = subset.header();
+
+    // The header is followed by the segments array and the per-point arrays, whose positions follow from the counts,
+    // so the file is allocated at its final size and the data of every strand is copied in place, strands in parallel
+    size_t size = sizeof(cyHairFile::Header);
+    const size_t segments_pos = size;
+    if (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT)
+        size += header.hair_count * sizeof(unsigned short);
+
+    struct Array {
+        const float* data;
+        unsigned int dim;
+        size_t pos;
+    };
+    std::vector<Array> arrays;
+    const auto add_array = [&](unsigned int bit, const float* data, unsigned int dim) {
+        if (header.arrays & bit) {
+            arrays.push_back({ data, dim, size });
+            size += size_t(dim) * header.point_count * sizeof(float);
+        }
+    };
+    add_array(_CY_HAIR_FILE_POINTS_BIT, subset.base->GetPointsArray(), 3);
+    add_array(_CY_HAIR_FILE_THICKNESS_BIT, subset.base->GetThicknessArray(), 1);
+    add_array(_CY_HAIR_FILE_TRANSPARENCY_BIT, subset.base->GetTransparencyArray(), 1);
+    add_array(_CY_HAIR_FILE_COLORS_BIT, subset.base->GetColorsArray(), 3);
+
+    MappedOutputFile file(filename, size);
+    std::memcpy(file.data(), &header, sizeof(cyHairFile::Header));
+
+    parallel::for_each_strand(subset.offsets, [&](unsigned int hair_idx, size_t offset, size_t num_segments) {
+        if (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT) {
+            const unsigned short segments = num_segments;
+            std::memcpy(file.data() + segments_pos + hair_idx * sizeof(unsigned short), &segments, sizeof(unsigned short));
+        }
+        for (const Array& array : arrays) {
+            std::memcpy(file.data() + array.pos + array.dim * offset * sizeof(float),
+                        array.data + array.dim * subset.base_offset(hair_idx),
+                        array.dim * (num_segments + 1) * sizeof(float));
+        }
+    });
+    file.commit();
 }
@@ -0,0 +1,382 @@
+/*
+hairutil's own format, compact and randomly accessible:
+    Header (HzcHeader)
+    Chunk index (ChunkEntry of every chunk)
+    Chunk data
+Every chunk holds consecutive strands and can be decoded on its own: the number of segments of every strand, then the
+per-point arrays of the hair, component by component. Values are quantized to multiples of 2 * error (or their bits
+are taken as integers if error is 0, which is lossless, magnitude bits flipped for negative values), every point after the first one of a strand is stored as the
+difference to the previous point, and the numbers are written as zigzag varints. Chunks may then be compressed with zlib.
+*/
+
+#include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+#include <zlib.h>
+
+namespace {
+
+struct HzcHeader {
+    char signature[4];              // "HZC1"
+    uint32_t hair_count;
+    uint32_t point_count;
+    uint32_t arrays;                // Arrays of the hair, as in cyHairFile
+    uint32_t d_segments;
+    float d_thickness;
+    float d_transparency;
+    float d_color[3];
+    float error;                    // Maximum absolute error of the stored values (0 for lossless)
+    uint32_t chunk_count;
+    uint32_t deflated;              // Whether the chunks are compressed with zlib
+    char reserved[12];
+};
+static_assert(sizeof(HzcHeader) == 64);
+
+struct ChunkEntry {
+    uint32_t first_hair;            // First strand of the chunk; the chunk ends at the first strand of the next one
+    uint32_t first_point;
+    uint64_t offset;                // Position of the chunk data in the file
+    uint64_t size;                  // Size of the chunk data in the file
+    uint64_t raw_size;              // Size of the chunk data after decompression
+};
+static_assert(sizeof(ChunkEntry) == 32);
+
+// Chunks are cut at the strand reaching this number of points
+const unsigned int chunk_points = 64 * 1024;
+
+// Per-point arrays in the order they are stored, with their number of components
+const std::array<std::pair<unsigned int, unsigned int>, 4> point_arrays = {{
+    { _CY_HAIR_FILE_POINTS_BIT, 3 },
+    { _CY_HAIR_FILE_THICKNESS_BIT, 1 },
+    { _CY_HAIR_FILE_TRANSPARENCY_BIT, 1 },
+    { _CY_HAIR_FILE_COLORS_BIT, 3 },
+}};
+
+// Mapping between floats and the integers stored for them
+struct Quantizer {
+    double step;                    // Twice the error, or 0 for taking the bits of floats as integers
+
+    int64_t quantize(float x) const {
+        if (step == 0.0) {
+            // Bijective, so that -0.0f and NaN payloads survive, and ordered like the floats
+            int32_t bits;
+            std::memcpy(&bits, &x, sizeof(float));
+            return bits < 0 ? bits ^ 0x7fffffff : bits;
+        }
+        const double q = std::round(x / step);
+        if (!(std::abs(q) < 0x1p53)) {
+            throw std::runtime_error(fmt::format("Cannot quantize {} with error {}", x, step / 2));
+        }
+        return int64_t(q);
+    }
+
+    float dequantize(int64_t q) const {
+        if (step == 0.0) {
+            if (q < std::numeric_limits<int32_t>::min() || q > std::numeric_limits<int32_t>::max()) {
+                throw std::runtime_error(fmt::format("Invalid lossless value {}", q));
+            }
+            const int32_t bits = q < 0 ? int32_t(q) ^ 0x7fffffff : int32_t(q);
+            float x;
+            std::memcpy(&x, &bits, sizeof(float));
+            return x;
+        }
+        return float(q * step);
+    }
+};
+
+void put_varint(std::string& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer += char(value | 0x80);
+        value >>= 7;
+    }
+    buffer += char(value);
+}
+
+uint64_t zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+
+// Reader of the varints of a decompressed chunk, throwing at its end
+struct ChunkReader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    const std::string& name;
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            if (pos == end) {
+                throw std::runtime_error(fmt::format("Unexpected end of {}", name));
+            }
+            const unsigned char byte = *pos++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error(fmt::format("Invalid number in {}", name));
+    }
+};
+
+// Data of strands [begin, end) of the hair
+std::string encode_chunk(const cyHairFile& hairfile, const std::vector<unsigned int>& offsets, unsigned int begin, unsigned int end, const Quantizer& quantizer) {
+    std::string buffer;
+    for (unsigned int i = begin; i < end; ++i)
+        put_varint(buffer, offsets[i + 1] - offsets[i] - 1);
+
+    for (const auto& [bit, dim] : point_arrays) {
+        if (!(hairfile.GetHeader().arrays & bit))
+            continue;
+        const float* array = io::get_array(hairfile, bit);
+        for (unsigned int c = 0; c < dim; ++c) {
+            for (unsigned int i = begin; i < end; ++i) {
+                int64_t previous = 0;
+                for (unsigned int k = offsets[i]; k < offsets[i + 1]; ++k) {
+                    const int64_t q = quantizer.quantize(array[dim * k + c]);
+                    put_varint(buffer, zigzag(q - previous));
+                    previous = q;
+                }
+            }
+        }
+    }
+    return buffer;
+}
+
+// Strands of a decoded chunk, with the per-point arrays of their points
+struct Chunk {
+    std::vector<unsigned int> offsets = { 0 };
+    std::array<std::vector<float>, point_arrays.size()> arrays;     // Empty for arrays not in the file
+};
+
+Chunk decode_chunk(const unsigned char* data, size_t size, const HzcHeader& header, unsigned int hair_count, unsigned int point_count, const std::string& name) {
+    ChunkReader reader{ data, data + size, name };
+    Chunk chunk;
+    chunk.offsets.reserve(hair_count + 1);
+    for (unsigned int i = 0; i < hair_count; ++i) {
+        const uint64_t nsegs = reader.varint();
+        if (nsegs > std::numeric_limits<unsigned short>::max() || (!(header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT) && nsegs != header.d_segments)) {
+            throw std::runtime_error(fmt::format("Invalid number of segments of strand {} in {}: {}", i, name, nsegs));
+        }
+        chunk.offsets.push_back(chunk.offsets.back() + nsegs + 1);
+    }
+    if (chunk.offsets.back() != point_count) {
+        throw std::runtime_error(fmt::format("Invalid number of points in {}: expected {}, got {}", name, point_count, chunk.offsets.back()));
+    }
+
+    const Quantizer quantizer{ 2.0 * header.error };
+    for (size_t a = 0; a < point_arrays.size(); ++a) {
+        const auto [bit, dim] = point_arrays[a];
+        if (!(header.arrays & bit))
+            continue;
+        std::vector<float>& array = chunk.arrays[a];
+        array.resize(size_t(dim) * point_count);
+        for (unsigned int c = 0; c < dim; ++c) {
+            for (unsigned int i = 0; i < hair_count; ++i) {
+                int64_t q = 0;
+                for (unsigned int k = chunk.offsets[i]; k < chunk.offsets[i + 1]; ++k) {
+                    q += unzigzag(reader.varint());
+                    array[dim * k + c] = quantizer.dequantize(q);
+                }
+            }
+        }
+    }
+    return chunk;
+}
+
+HzcHeader read_header(const MappedFile& file, const std::string& filename) {
+    const HzcHeader header = file.read<HzcHeader>(0);
+    if (std::string_view(header.signature, 4) != "HZC1") {
+        throw std::runtime_error(fmt::format("Invalid HZC file {}: wrong signature", filename));
+    }
+    return header;
+}
+
+// Strands in the given ranges of the file, decoding only the chunks holding them
+std::shared_ptr<cyHairFile> load_strands(const MappedFile& file, const HzcHeader& header, const std::string& filename, const io::strand_ranges_t& ranges) {
+    io::check_strand_ranges(ranges, header.hair_count, filename);
+
+    file.check_range(sizeof(HzcHeader), sizeof(ChunkEntry) * header.chunk_count);
+    std::vector<ChunkEntry> index(header.chunk_count);
+    std::memcpy(index.data(), file.data() + sizeof(HzcHeader), sizeof(ChunkEntry) * header.chunk_count);
+    index.push_back({ header.hair_count, header.point_count, 0, 0, 0 });
+    if ((header.chunk_count == 0) != (header.hair_count == 0) || index[0].first_hair != 0) {
+        throw std::runtime_error(fmt::format("Invalid index of {}", filename));
+    }
+
+    // Pieces of the ranges lying in a single chunk: the chunk and the strands of the range within it
+    struct Piece {
+        size_t chunk;
+        unsigned int i_begin, i_end;
+    };
+    const auto chunk_of = [&](unsigned int hair_idx) {
+        return std::upper_bound(index.begin(), index.end() - 1, hair_idx, [](unsigned int i, const ChunkEntry& entry) { return i < entry.first_hair; }) - index.begin() - 1;
+    };
+    std::vector<Piece> pieces;
+    std::vector<unsigned char> needed(header.chunk_count);
+    for (const auto& [begin, end] : ranges) {
+        if (begin == end)
+            continue;
+        for (size_t k = chunk_of(begin); k <= size_t(chunk_of(end - 1)); ++k) {
+            const unsigned int first_hair = index[k].first_hair;
+            const unsigned int last_hair = index[k + 1].first_hair;
+            pieces.push_back({ k, std::max(begin, first_hair) - first_hair, std::min(end, last_hair) - first_hair });
+            needed[k] = 1;
+        }
+    }
+
+    // Number of components of the per-point arrays of the file
+    unsigned int point_dims = 0;
+    for (const auto& [bit, dim] : point_arrays) {
+        if (header.arrays & bit)
+            point_dims += dim;
+    }
+
+    // Decode the needed chunks in parallel
+    std::vector<Chunk> chunks(header.chunk_count);
+    parallel::for_range(chunks.size(), [&](size_t range_begin, size_t range_end) {
+        std::vector<unsigned char> inflated;
+        for (size_t k = range_begin; k < range_end; ++k) {
+            if (!needed[k])
+                continue;
+            const ChunkEntry& entry = index[k];
+            const ChunkEntry& next = index[k + 1];
+            const std::string name = fmt::format("chunk {} of {}", k, filename);
+            if (next.first_hair < entry.first_hair || next.first_point < entry.first_point) {
+                throw std::runtime_error(fmt::format("Invalid index of {}", name));
+            }
+            file.check_range(entry.offset, entry.size);
+            const unsigned char* data = reinterpret_cast<const unsigned char*>(file.data() + entry.offset);
+            size_t size = entry.size;
+            if (header.deflated) {
+                // Every number of the chunk takes at most 10 bytes, which bounds the buffer before trusting raw_size
+                const uint64_t max_raw_size = (uint64_t(next.first_hair - entry.first_hair) + uint64_t(next.first_point - entry.first_point) * point_dims) * 10;
+                if (entry.raw_size > max_raw_size) {
+                    throw std::runtime_error(fmt::format("Invalid decompressed size of {}: {}", name, entry.raw_size));
+                }
+                inflated.resize(entry.raw_size);
+                uLongf inflated_size = entry.raw_size;
+                if (::uncompress(inflated.data(), &inflated_size, data, entry.size) != Z_OK || inflated_size != entry.raw_size) {
+                    throw std::runtime_error(fmt::format("Cannot decompress {}", name));
+                }
+                data = inflated.data();
+                size = inflated_size;
+            }
+            chunks[k] = decode_chunk(data, size, header, next.first_hair - entry.first_hair, next.first_point - entry.first_point, name);
+        }
+    });
+
+    // Strand and point offsets of every piece in the loaded hair
+    std::vector<unsigned int> hair_offsets = { 0 };
+    std::vector<unsigned int> point_offsets = { 0 };
+    for (const Piece& piece : pieces) {
+        hair_offsets.push_back(hair_offsets.back() + piece.i_end - piece.i_begin);
+        point_offsets.push_back(point_offsets.back() + chunks[piece.chunk].offsets[piece.i_end] - chunks[piece.chunk].offsets[piece.i_begin]);
+    }
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+    hairfile->SetArrays(header.arrays);
+    hairfile->SetDefaultSegmentCount(header.d_segments);
+    hairfile->SetDefaultThickness(header.d_thickness);
+    hairfile->SetDefaultTransparency(header.d_transparency);
+    hairfile->SetDefaultColor(header.d_color[0], header.d_color[1], header.d_color[2]);
+
+    // Copy the strands of every piece into place, pieces in parallel
+    parallel::for_range(pieces.size(), [&](size_t range_begin, size_t range_end) {
+        for (size_t c = range_begin; c < range_end; ++c) {
+            const Chunk& chunk = chunks[pieces[c].chunk];
+            const unsigned int i_begin = pieces[c].i_begin, i_end = pieces[c].i_end;
+            if (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT) {
+                for (unsigned int i = i_begin; i < i_end; ++i)
+                    hairfile->GetSegmentsArray()[hair_offsets[c] + i - i_begin] = chunk.offsets[i + 1] - chunk.offsets[i] - 1;
+            }
+            for (size_t a = 0; a < point_arrays.size(); ++a) {
+                const auto [bit, dim] = point_arrays[a];
+                if (header.arrays & bit)
+                    std::copy(chunk.arrays[a].begin() + dim * chunk.offsets[i_begin], chunk.arrays[a].begin() + dim * chunk.offsets[i_end], io::get_array(*hairfile, bit) + dim * point_offsets[c]);
+            }
+        }
+    });
+
+    return hairfile;
+}
+
+}
+
+std::shared_ptr<cyHairFile> io::load_hzc(const std::string &filename) {
+    const MappedFile file(filename);
+    const HzcHeader header = read_header(file, filename);
+    return load_strands(file, header, filename, {{ 0, header.hair_count }});
+}
+
+std::shared_ptr<cyHairFile> io::load_hzc_subset(const std::string &filename, const strand_ranges_t &ranges) {
+    const MappedFile file(filename);
+    return load_strands(file, read_header(file, filename), filename, ranges);
+}
+
+void io::save_hzc(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
+    const cyHairFile::Header& hair_header = hairfile->GetHeader();
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+
+    HzcHeader header = {};
+    std::memcpy(header.signature, "HZC1", 4);
+    header.hair_count = hair_header.hair_count;
+    header.point_count = hair_header.point_count;
+    header.arrays = hair_header.arrays & (_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT | _CY_HAIR_FILE_THICKNESS_BIT | _CY_HAIR_FILE_TRANSPARENCY_BIT | _CY_HAIR_FILE_COLORS_BIT);
+    header.d_segments = hair_header.d_segments;
+    header.d_thickness = hair_header.d_thickness;
+    header.d_transparency = hair_header.d_transparency;
+    std::copy(hair_header.d_color, hair_header.d_color + 3, header.d_color);
+    header.error = globals::hzc_error;
+    header.deflated = globals::hzc_deflate_level > 0;
+
+    // Cut the strands into chunks of about chunk_points points
+    std::vector<ChunkEntry> index;
+    for (unsigned int i = 0; i < header.hair_count; ) {
+        index.push_back({ i, offsets[i], 0, 0, 0 });
+        const unsigned int first_point = offsets[i];
+        while (i < header.hair_count && offsets[i] - first_point < chunk_points)
+            ++i;
+    }
+    header.chunk_count = index.size();
+    index.push_back({ header.hair_count, header.point_count, 0, 0, 0 });
+
+    // Encode the chunks in parallel
+    const Quantizer quantizer{ 2.0 * header.error };
+    std::vector<std::string> chunks(header.chunk_count);
+    parallel::for_range(chunks.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            std::string raw = encode_chunk(*hairfile, offsets, index[k].first_hair, index[k + 1].first_hair, quantizer);
+            index[k].raw_size = raw.size();
+            if (!header.deflated) {
+                chunks[k] = std::move(raw);
+                continue;
+            }
+            uLongf size = ::compressBound(raw.size());
+            chunks[k].resize(size);
+            if (::compress2(reinterpret_cast<Bytef*>(chunks[k].data()), &size, reinterpret_cast<const Bytef*>(raw.data()), raw.size(), globals::hzc_deflate_level) != Z_OK) {
+                throw std::runtime_error(fmt::format("Cannot compress chunk {} of {}", k, filename));
+            }
+            chunks[k].resize(size);
+        }
+    });
+    index.pop_back();
+
+    uint64_t offset = sizeof(HzcHeader) + sizeof(ChunkEntry) * index.size();
+    for (size_t k = 0; k < index.size(); ++k) {
+        index[k].offset = offset;
+        index[k].size = chunks[k].size();
+        offset += chunks[k].size();
+    }
+
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary);
+    if (!ofs.is_open()) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    }
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(HzcHeader));
+    ofs.write(reinterpret_cast<const char*>(index.data()), sizeof(ChunkEntry) * index.size());
+    for (const std::string& chunk : chunks)
+        ofs.write(chunk.data(), chunk.size());
+
+    log_debug("Saved {} strands in {} chunks: {} bytes ({:.1f} bits per point)", header.hair_count, header.chunk_count, offset, header.point_count ? 8.0 * offset / header.point_count : 0.0);
+}
@@ -1,100 +1,197 @@
 #include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
 
-using namespace Eigen;
+#include <charconv>
 
-std::shared_ptr<cyHairFile> io::load_ma(const std::string &filename) {
-    std::ifstream ifs;
-    ifs.open(filename.c_str());
-
-    // Skip the first two lines
-    std::string line;
-    std::getline(ifs, line);
-    std::getline(ifs, line);
-
-    // Read data into std::vector
-    std::vector<float> points_array;
-    std::vector<unsigned short> segments_array;
-    points_array.reserve(200000 * 3);
-    segments_array.reserve(200000);
-
-    // Loop until the end of file
-    for ( ; std::getline(ifs, line); ) {
-        if (segments_array.size() && segments_array.size() % 100 == 0)
-            spdlog::trace("Processing hair {}", segments_array.size());
-
-        // Skip the first 5 lines
-        for (int i = 0; i < 5; ++i)
-            std::getline(ifs, line);
-
-        // Read the number of vertices
-        std::getline(ifs, line);
-        std::istringstream iss(line);
-        unsigned int num_vertices;
-        iss >> num_vertices;
-
-        segments_array.push_back(num_vertices - 1);
-
-        // Read individual vertices
-        for (int i = 0; i < num_vertices; ++i) {
-            std::getline(ifs, line);
-            std::istringstream iss(line);
-            float x, y, z;
-            iss >> x >> y >> z;
-            points_array.push_back(x);
-            points_array.push_back(y);
-            points_array.push_back(z);
-        }
+namespace {
+
+// Next whitespace-delimited token at or after p, moving p past it (empty at the end of the range)
+std::string_view next_token(const char*& p, const char* end) {
+    while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+        ++p;
+    const char* begin = p;
+    while (p < end && !std::isspace(static_cast<unsigned char>(*p)))
+        ++p;
+    return std::string_view(begin, p - begin);
+}
 
-        // Skip the last line
-        getline(ifs, line);
+template <class T>
+T parse_number(std::string_view token, const std::string& filename) {
+    T value;
+    const auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (ec != std::errc() || ptr != token.data() + token.size()) {
+        throw std::runtime_error(fmt::format("Invalid number in {}: '{}'", filename, token));
     }
+    return value;
+}
+
+// Position of every occurrence of pattern in text, searching chunks of text in parallel
+std::vector<size_t> find_all(std::string_view text, std::string_view pattern) {
+    const size_t chunk_size = 1 << 22;
+    const size_t num_chunks = (text.size() + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<size_t>> chunk_positions(num_chunks);
+    parallel::for_range(num_chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            // Occurrences starting in the chunk, possibly running over its end
+            const size_t chunk_end = std::min(text.size(), (c + 1) * chunk_size);
+            const std::string_view chunk = text.substr(0, std::min(text.size(), chunk_end + pattern.size() - 1));
+            for (size_t pos = chunk.find(pattern, c * chunk_size); pos < chunk_end; pos = chunk.find(pattern, pos + 1))
+                chunk_positions[c].push_back(pos);
+        }
+    });
+    std::vector<size_t> positions;
+    for (const std::vector<size_t>& p : chunk_positions)
+        positions.insert(positions.end(), p.begin(), p.end());
+    return positions;
+}
+
+}
+
+std::shared_ptr<cyHairFile> io::load_ma(const std::string &filename) {
+    const MappedFile file(filename);
+    const std::string_view text(file.data(), file.size());
+
+    // Every curve is a nurbsCurve node, whose CVs are given by the ".cc" attribute:
+    //   setAttr ".cc" -type "nurbsCurve"
+    //       degree spans form rational dimension
+    //       knot_count knot...
+    //       cv_count
+    //       x y [z] [w] ...
+    //       ;
+    const std::vector<size_t> node_positions = find_all(text, "createNode nurbsCurve");
+
+    // First pass: read the header of the CVs of every curve
+    struct Curve {
+        const char* cvs = nullptr;          // Start of the CVs (nullptr for a curve without ".cc")
+        unsigned int num_cvs = 0;
+        unsigned int dimension = 3;
+        bool rational = false;
+    };
+    std::vector<Curve> curves(node_positions.size());
+    parallel::for_range(curves.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const std::string_view node = text.substr(node_positions[k], (k + 1 < curves.size() ? node_positions[k + 1] : text.size()) - node_positions[k]);
+            const size_t cc_pos = node.find("setAttr \".cc\"");
+            if (cc_pos == std::string_view::npos)
+                continue;
+            const size_t type_pos = node.find("\"nurbsCurve\"", cc_pos);
+            if (type_pos == std::string_view::npos) {
+                throw std::runtime_error(fmt::format("Unexpected type of \".cc\" of curve {} in {}", k, filename));
+            }
+            const char* p = node.data() + type_pos + std::string_view("\"nurbsCurve\"").size();
+            const char* node_end = node.data() + node.size();
+
+            Curve& curve = curves[k];
+            next_token(p, node_end);                                        // degree
+            next_token(p, node_end);                                        // spans
+            next_token(p, node_end);                                        // form
+            curve.rational = next_token(p, node_end) == "yes";
+            curve.dimension = parse_number<unsigned int>(next_token(p, node_end), filename);
+            if (curve.dimension != 2 && curve.dimension != 3) {
+                throw std::runtime_error(fmt::format("Unsupported dimension of curve {} in {}: {}", k, filename, curve.dimension));
+            }
+            const unsigned int num_knots = parse_number<unsigned int>(next_token(p, node_end), filename);
+            for (unsigned int i = 0; i < num_knots; ++i)
+                next_token(p, node_end);
+            curve.num_cvs = parse_number<unsigned int>(next_token(p, node_end), filename);
+            if (curve.num_cvs < 1 || curve.num_cvs - 1 > std::numeric_limits<unsigned short>::max()) {
+                throw std::runtime_error(fmt::format("Invalid number of CVs of curve {} in {}: {}", k, filename, curve.num_cvs));
+            }
+            curve.cvs = p;
+        }
+    });
+    std::erase_if(curves, [](const Curve& curve) { return !curve.cvs; });
+    if (curves.size() < node_positions.size())
+        log_warn("Skipped {} nurbsCurve nodes without \".cc\" attribute", node_positions.size() - curves.size());
 
     // Create cyHairFile
+    unsigned int point_count = 0;
+    for (const Curve& curve : curves)
+        point_count += curve.num_cvs;
     auto hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(curves.size());
+    hairfile->SetPointCount(point_count);
     hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
-    hairfile->SetHairCount(segments_array.size());
-    hairfile->SetPointCount(points_array.size() / 3);
-
-    // Copy content of segments_array and points_array to hairfile
-    std::memcpy(hairfile->GetSegmentsArray(), segments_array.data(), segments_array.size() * sizeof(unsigned short));
-    std::memcpy(hairfile->GetPointsArray(), points_array.data(), points_array.size() * sizeof(float));
+    for (size_t k = 0; k < curves.size(); ++k)
+        hairfile->GetSegmentsArray()[k] = curves[k].num_cvs - 1;
+
+    // Second pass: parse the CVs of every curve into the points array, curves in parallel
+    parallel::for_each_strand(hairfile->GetOffsetsArray(), [&](unsigned int k, size_t offset, size_t) {
+        const Curve& curve = curves[k];
+        const char* p = curve.cvs;
+        const char* end = file.data() + file.size();
+        float* points = hairfile->GetPointsArray() + 3 * offset;
+        for (unsigned int i = 0; i < curve.num_cvs; ++i) {
+            for (unsigned int d = 0; d < 3; ++d)
+                points[3 * i + d] = d < curve.dimension ? parse_number<float>(next_token(p, end), filename) : 0.0f;
+            if (curve.rational)
+                next_token(p, end);
+        }
+    });
 
     return hairfile;
 }
 
 void io::save_ma(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
-    std::ofstream ofs(filename.c_str());
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
 
-    ofs << "requires maya \"2014\";" << endl;
-    ofs << "createNode transform -n \"group1\";" << endl;
+    if (!ofs.is_open()) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    }
 
-    int point_idx = 0;
+    ofs << "requires maya \"2014\";\n";
+    ofs << "createNode transform -n \"group1\";\n";
 
     const auto& header = hairfile->GetHeader();
-
-    for (int hair_idx = 0; hair_idx < header.hair_count; ++hair_idx) {
-        if (hair_idx && (hair_idx % 100 == 0))
-            spdlog::trace("Processing hair {}/{}", hair_idx, header.hair_count);
-
-        ofs << "createNode transform -n \"curve" << (hair_idx + 1) << "\" -p \"group1\";" << endl;
-        ofs << "createNode nurbsCurve -n \"curveShape" << (hair_idx + 1) << "\" -p \"curve" << (hair_idx + 1) << "\";" << endl;
-        ofs << "    setAttr -k off \".v\";" << endl;
-        ofs << "    setAttr \".cc\" -type \"nurbsCurve\"" << endl;
-
-        int s = hairfile->GetSegmentsArray() ? hairfile->GetSegmentsArray()[hair_idx] : header.d_segments;
-
-        ofs << "        1 " << s << " 0 no 3" << endl;
-
-        ofs << "        " << (s + 1);
-        for (int i = 0; i <= s; ++i)
-            ofs << " " << i;
-        ofs << endl;
-
-        ofs << "        " << (s + 1) << endl;
-
-        for (int i = 0; i <= s; ++i, ++point_idx)
-            ofs << "        " << Map<RowVector3f>(&hairfile->GetPointsArray()[3 * point_idx]) << endl;
-
-        ofs << "        ;" << endl;
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+    const float* points = hairfile->GetPointsArray();
+
+    const auto format_strand = [&](std::string& buffer, unsigned int hair_idx) {
+        const auto out = std::back_inserter(buffer);
+        const unsigned int s = offsets[hair_idx + 1] - offsets[hair_idx] - 1;
+
+        fmt::format_to(out, "createNode transform -n \"curve{0}\" -p \"group1\";\n", hair_idx + 1);
+        fmt::format_to(out, "createNode nurbsCurve -n \"curveShape{0}\" -p \"curve{0}\";\n", hair_idx + 1);
+        buffer += "    setAttr -k off \".v\";\n";
+        buffer += "    setAttr \".cc\" -type \"nurbsCurve\"\n";
+        fmt::format_to(out, "        1 {} 0 no 3\n", s);
+
+        fmt::format_to(out, "        {}", s + 1);
+        for (unsigned int i = 0; i <= s; ++i)
+            fmt::format_to(out, " {}", i);
+        buffer += '\n';
+
+        fmt::format_to(out, "        {}\n", s + 1);
+
+        // Shortest representation that reads back to the same float
+        for (unsigned int point_idx = offsets[hair_idx]; point_idx < offsets[hair_idx + 1]; ++point_idx)
+            fmt::format_to(out, "        {} {} {}\n", points[3 * point_idx], points[3 * point_idx + 1], points[3 * point_idx + 2]);
+
+        buffer += "        ;\n";
+    };
+
+    // Format blocks of strands into buffers of their own in parallel, then write the buffers in order.
+    // Strands are processed in batches so that the buffers do not hold the whole file at once.
+    const unsigned int block_size = 1024;
+    const unsigned int batch_size = 64 * block_size;
+    std::vector<std::string> buffers;
+    for (unsigned int batch_begin = 0; batch_begin < header.hair_count; batch_begin += batch_size) {
+        const unsigned int batch_end = std::min(header.hair_count, batch_begin + batch_size);
+        spdlog::trace("Processing hair {}/{}", batch_begin, header.hair_count);
+
+        buffers.resize((batch_end - batch_begin + block_size - 1) / block_size);
+        parallel::for_range(buffers.size(), [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                buffers[b].clear();
+                const unsigned int block_begin = batch_begin + b * block_size;
+                const unsigned int block_end = std::min(batch_end, block_begin + block_size);
+                for (unsigned int hair_idx = block_begin; hair_idx < block_end; ++hair_idx)
+                    format_strand(buffers[b], hair_idx);
+            }
+        });
+
+        for (const std::string& buffer : buffers)
+            ofs.write(buffer.data(), buffer.size());
     }
 }
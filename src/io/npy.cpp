@@ -1,42 +1,268 @@
 #include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
 
-#include <npy.hpp>
+/*
+NumPy .npy format: https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html
+Hair of strands with the same number of points is stored as one (hair_count, num_points, 3) float array.
+Other hair is stored ragged, as a (point_count, 3) float array of the points of all strands, with the point offset of
+every strand (plus one trailing entry equal to point_count) in a (hair_count + 1,) uint32 array in <name>_offsets.npy,
+so that strand i is points[offsets[i]:offsets[i+1]] in Python.
+*/
+
+namespace {
+
+struct NpyHeader {
+    std::string descr;
+    std::vector<size_t> shape;
+    size_t data_offset = 0;
+
+    size_t size() const { return std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>()); }
+};
+
+// Parse the header of a .npy file, given as a MappedFile or a RandomAccessFile
+template <class File>
+NpyHeader read_npy_header(const File& file, const std::string& filename) {
+    const std::string_view magic = "\x93NUMPY";
+    if (file.size() < magic.size() + 2 || std::string_view(file.template read<std::array<char, 6>>(0).data(), magic.size()) != magic) {
+        throw std::runtime_error(fmt::format("Invalid npy file {}: wrong magic string", filename));
+    }
+    const unsigned char major_version = file.template read<unsigned char>(magic.size());
+    size_t header_size, header_offset;
+    if (major_version == 1) {
+        header_size = file.template read<uint16_t>(magic.size() + 2);
+        header_offset = magic.size() + 2 + sizeof(uint16_t);
+    } else {
+        header_size = file.template read<uint32_t>(magic.size() + 2);
+        header_offset = magic.size() + 2 + sizeof(uint32_t);
+    }
+    std::string header(header_size, ' ');
+    file.read(header_offset, header_size, header.data());
+
+    NpyHeader array;
+    array.data_offset = header_offset + header_size;
+
+    // Value of a key of the header, which is a Python dict literal such as
+    // {'descr': '<f4', 'fortran_order': False, 'shape': (156, 32, 3), }
+    const auto value = [&](std::string_view key) {
+        const size_t key_pos = header.find(fmt::format("'{}'", key));
+        const size_t colon_pos = key_pos == std::string_view::npos ? key_pos : header.find(':', key_pos);
+        if (colon_pos == std::string_view::npos) {
+            throw std::runtime_error(fmt::format("Invalid npy file {}: no '{}' in header", filename, key));
+        }
+        const size_t begin = std::min(header.size() - 1, header.find_first_not_of(' ', colon_pos + 1));
+        const size_t end = header[begin] == '(' ? header.find(')', begin) + 1 : header.find_first_of(",}", begin);
+        return std::string_view(header).substr(begin, end - begin);
+    };
+
+    array.descr = std::string(value("descr"));
+    array.descr.erase(std::remove(array.descr.begin(), array.descr.end(), '\''), array.descr.end());
+    if (value("fortran_order") != "False") {
+        throw std::runtime_error(fmt::format("Unsupported npy file {}: Fortran order", filename));
+    }
+    const std::string_view shape = value("shape");
+    for (size_t pos = 1; pos < shape.size(); ) {
+        const size_t end = std::min(shape.size() - 1, shape.find(',', pos));
+        const std::string dim(shape.substr(pos, end - pos));
+        if (dim.find_first_not_of(' ') != std::string::npos)
+            array.shape.push_back(std::stoull(dim));
+        pos = end + 1;
+    }
+    return array;
+}
+
+struct NpyArray : NpyHeader {
+    std::shared_ptr<MappedFile> file;
+
+    const char* data() const { return file->data() + data_offset; }
+};
+
+// Map a .npy file and parse its header; the mapping is copy-on-write, so that hair can use the data in place
+NpyArray map_npy(const std::string& filename) {
+    NpyArray array;
+    array.file = std::make_shared<MappedFile>(filename, true);
+    static_cast<NpyHeader&>(array) = read_npy_header(*array.file, filename);
+    return array;
+}
+
+// Point the points array of hair into the data of a (point_count, 3) float array, copying it if it is not aligned for floats
+void set_points(cyHairFile& hairfile, cyHairFile::Header header, const NpyArray& array, std::shared_ptr<void> storage, unsigned short* segments = nullptr) {
+    header.arrays = _CY_HAIR_FILE_POINTS_BIT | (segments ? _CY_HAIR_FILE_SEGMENTS_BIT : 0);
+    header.point_count = array.size() / 3;
+    array.file->check_range(array.data_offset, array.size() * sizeof(float));
+    if (array.data_offset % alignof(float) == 0) {
+        hairfile.SetExternalArrays(header, std::move(storage), segments, reinterpret_cast<float*>(array.file->mutable_data() + array.data_offset), nullptr, nullptr, nullptr);
+    } else {
+        hairfile.SetHairCount(header.hair_count);
+        hairfile.SetPointCount(header.point_count);
+        hairfile.SetArrays(header.arrays);
+        hairfile.SetDefaultSegmentCount(header.d_segments);
+        if (segments)
+            std::copy(segments, segments + header.hair_count, hairfile.GetSegmentsArray());
+        std::memcpy(hairfile.GetPointsArray(), array.data(), array.size() * sizeof(float));
+    }
+}
+
+void write_npy(const std::string& filename, const std::string& descr, const std::vector<size_t>& shape, const void* data, size_t size) {
+    // Version 1.0 header, padded with spaces so that the data is 64-byte aligned
+    std::string shape_str;
+    for (const size_t dim : shape)
+        shape_str += fmt::format("{},{}", dim, shape.size() > 1 ? " " : "");
+    if (shape.size() > 1)
+        shape_str.resize(shape_str.size() - 2);
+    std::string header = fmt::format("{{'descr': '{}', 'fortran_order': False, 'shape': ({}), }}", descr, shape_str);
+    const size_t preamble_size = 10;
+    header.append(63 - (preamble_size + header.size()) % 64, ' ');
+    header += '\n';
+    const uint16_t header_size = header.size();
+
+    // Allocate the file at its final size and copy the data into place, chunks in parallel
+    const size_t data_offset = preamble_size + header.size();
+    MappedOutputFile file(filename, data_offset + size);
+    std::memcpy(file.data(), "\x93NUMPY\x01\x00", 8);
+    std::memcpy(file.data() + 8, &header_size, sizeof(header_size));
+    std::memcpy(file.data() + preamble_size, header.data(), header.size());
+    parallel::for_range(size, [&](size_t begin, size_t end) {
+        std::memcpy(file.data() + data_offset + begin, static_cast<const char*>(data) + begin, end - begin);
+    });
+    file.commit();
+}
+
+// Throw unless array holds points, as a (point_count, 3) (ragged) or (hair_count, num_points, 3) float array
+void check_points_array(const NpyHeader& array) {
+    if (array.descr != "<f4") {
+        throw std::runtime_error(fmt::format("Invalid data type in npy file: expected '<f4', got '{}'", array.descr));
+    }
+    if (array.shape.size() != 2 && array.shape.size() != 3) {
+        throw std::runtime_error(fmt::format("Invalid shape in npy file: expected 2D (ragged) or 3D array, got {}D array", array.shape.size()));
+    }
+    if (array.shape.back() != 3) {
+        throw std::runtime_error(fmt::format("Invalid shape in npy file: expected 3 channels, got {} channels", array.shape.back()));
+    }
+}
+
+// Number of segments of every strand of the ragged points file filename with point_count points, from its strand offsets file
+std::vector<unsigned short> read_segments(const std::string& filename, size_t point_count) {
+    const NpyArray offsets = map_npy(io::npy_offsets_filename(filename));
+    if (offsets.shape.size() != 1 || offsets.shape[0] < 1) {
+        throw std::runtime_error(fmt::format("Invalid shape in npy file {}: expected 1D array", io::npy_offsets_filename(filename)));
+    }
+    const auto read_offset = [&](size_t i) -> size_t {
+        if (offsets.descr == "<u4") return offsets.file->read<uint32_t>(offsets.data_offset + i * 4);
+        if (offsets.descr == "<i4") return offsets.file->read<int32_t>(offsets.data_offset + i * 4);
+        if (offsets.descr == "<u8") return offsets.file->read<uint64_t>(offsets.data_offset + i * 8);
+        if (offsets.descr == "<i8") return offsets.file->read<int64_t>(offsets.data_offset + i * 8);
+        throw std::runtime_error(fmt::format("Invalid data type in npy file {}: expected integers, got '{}'", io::npy_offsets_filename(filename), offsets.descr));
+    };
+
+    const size_t hair_count = offsets.shape[0] - 1;
+    std::vector<unsigned short> segments(hair_count);
+    if (read_offset(0) != 0 || read_offset(hair_count) != point_count) {
+        throw std::runtime_error(fmt::format("Invalid strand offsets in {}: expected 0 to {}", io::npy_offsets_filename(filename), point_count));
+    }
+    for (size_t i = 0; i < hair_count; ++i) {
+        const size_t begin = read_offset(i), end = read_offset(i + 1);
+        if (end <= begin || end - begin - 1 > std::numeric_limits<unsigned short>::max()) {
+            throw std::runtime_error(fmt::format("Invalid strand offsets in {}: strand {} has {} points", io::npy_offsets_filename(filename), i, int64_t(end - begin)));
+        }
+        segments[i] = end - begin - 1;
+    }
+    return segments;
+}
+
+}
 
 std::shared_ptr<cyHairFile> io::load_npy(const std::string &filename) {
-    npy::npy_data d = npy::read_npy<float>(filename);
-    if (d.shape.size() != 3) {
-        throw std::runtime_error(fmt::format("Invalid shape in npy file: expected 3D array, got {}D array", d.shape.size()));
+    const NpyArray array = map_npy(filename);
+    check_points_array(array);
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    cyHairFile::Header header = hairfile->GetHeader();
+
+    if (array.shape.size() == 3) {
+        header.hair_count = array.shape[0];
+        header.d_segments = array.shape[1] - 1;
+        set_points(*hairfile, header, array, array.file);
+        return hairfile;
     }
-    if (d.shape[2] != 3) {
-        throw std::runtime_error(fmt::format("Invalid shape in npy file: expected 3 channels, got {} channels", d.shape[2]));
+
+    // Ragged points, with the strand offsets in a file of their own.
+    // The segments array outlives this function along with the mapping of the points.
+    struct Storage {
+        std::shared_ptr<MappedFile> file;
+        std::vector<unsigned short> segments;
+    };
+    auto storage = std::make_shared<Storage>();
+    storage->file = array.file;
+    storage->segments = read_segments(filename, array.shape[0]);
+    header.hair_count = storage->segments.size();
+    set_points(*hairfile, header, array, storage, storage->segments.data());
+    return hairfile;
+}
+
+std::shared_ptr<cyHairFile> io::load_npy_subset(const std::string &filename, const strand_ranges_t &ranges) {
+    const RandomAccessFile file(filename);
+    const NpyHeader array = read_npy_header(file, filename);
+    check_points_array(array);
+
+    // Point offsets of all strands, from the strand offsets file for ragged points
+    const bool uniform_nsegs = array.shape.size() == 3;
+    const std::vector<unsigned short> segments = uniform_nsegs ? std::vector<unsigned short>(array.shape[0], array.shape[1] - 1) : read_segments(filename, array.shape[0]);
+    check_strand_ranges(ranges, segments.size(), filename);
+    std::vector<size_t> offsets = { 0 };
+    for (const unsigned short nsegs : segments)
+        offsets.push_back(offsets.back() + nsegs + 1);
+
+    // Strand and point offsets of every range in the loaded hair
+    std::vector<unsigned int> hair_offsets = { 0 };
+    std::vector<unsigned int> point_offsets = { 0 };
+    for (const auto& [begin, end] : ranges) {
+        hair_offsets.push_back(hair_offsets.back() + end - begin);
+        point_offsets.push_back(point_offsets.back() + offsets[end] - offsets[begin]);
     }
 
     std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
-    hairfile->SetArrays(_CY_HAIR_FILE_POINTS_BIT);
-    hairfile->SetHairCount(d.shape[0]);
-    hairfile->SetDefaultSegmentCount(d.shape[1] - 1);
-    hairfile->SetPointCount(d.data.size() / 3);
-    std::memcpy(hairfile->GetPointsArray(), d.data.data(), d.data.size() * sizeof(float));
+    hairfile->SetHairCount(hair_offsets.back());
+    hairfile->SetPointCount(point_offsets.back());
+    hairfile->SetArrays(_CY_HAIR_FILE_POINTS_BIT | (uniform_nsegs ? 0 : _CY_HAIR_FILE_SEGMENTS_BIT));
+    if (uniform_nsegs)
+        hairfile->SetDefaultSegmentCount(array.shape[1] - 1);
 
+    parallel::for_range(ranges.size(), [&](size_t range_begin, size_t range_end) {
+        for (size_t r = range_begin; r < range_end; ++r) {
+            const auto [begin, end] = ranges[r];
+            if (!uniform_nsegs)
+                std::copy(segments.begin() + begin, segments.begin() + end, hairfile->GetSegmentsArray() + hair_offsets[r]);
+            file.read(array.data_offset + 3 * sizeof(float) * offsets[begin], 3 * sizeof(float) * (offsets[end] - offsets[begin]), hairfile->GetPointsArray() + 3 * point_offsets[r]);
+        }
+    });
     return hairfile;
 }
 
+std::string io::npy_offsets_filename(const std::string &filename) {
+    const std::filesystem::path path(filename);
+    return (path.parent_path() / (path.stem().string() + "_offsets.npy")).string();
+}
+
 void io::save_npy(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
-    unsigned int hair_count = hairfile->GetHeader().hair_count;
-    unsigned int num_segments;
-    if (hairfile->GetSegmentsArray()) {
-        num_segments = hairfile->GetSegmentsArray()[0];
-        for (unsigned int i = 1; i < hair_count; ++i) {
-            if (hairfile->GetSegmentsArray()[i] != num_segments) {
-                throw std::runtime_error(fmt::format("Inconsistent segment count: {} vs {} at {}", hairfile->GetSegmentsArray()[i], num_segments, i));
-            }
-        }
-    } else {
-        num_segments = hairfile->GetHeader().d_segments;
+    const auto& header = hairfile->GetHeader();
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+
+    bool uniform_nsegs = true;
+    for (unsigned int i = 1; i < header.hair_count && uniform_nsegs; ++i)
+        uniform_nsegs = offsets[i + 1] - offsets[i] == offsets[1] - offsets[0];
+
+    const size_t points_size = size_t(header.point_count) * 3 * sizeof(float);
+    if (uniform_nsegs) {
+        const size_t num_points = header.hair_count ? offsets[1] : header.d_segments + 1;
+        write_npy(filename, "<f4", { header.hair_count, num_points, 3 }, hairfile->GetPointsArray(), points_size);
+
+        // Remove the offsets of a ragged file previously saved there, which would no longer go with the points
+        std::filesystem::remove(npy_offsets_filename(filename));
+        return;
     }
 
-    npy::npy_data_ptr<float> d;
-    d.data_ptr = hairfile->GetPointsArray();
-    d.shape = {hair_count, num_segments + 1, 3};
-    npy::write_npy<float>(filename, d);
+    log_info("Strands have different numbers of segments, writing points and strand offsets to {} and {}", filename, npy_offsets_filename(filename));
+    write_npy(filename, "<f4", { header.point_count, 3 }, hairfile->GetPointsArray(), points_size);
+    write_npy(npy_offsets_filename(filename), "<u4", { offsets.size() }, offsets.data(), offsets.size() * sizeof(unsigned int));
 }
@@ -1,8 +1,463 @@
 #include "io.h"
+#include "mapped_file.h"
+#include "parallel.h"
 
+#include <bit>
+#include <charconv>
 #include <happly.h>
 
-std::shared_ptr<cyHairFile> io::load_ply(const std::string &filename) {
+namespace {
+
+// Error if the hair has no "strand" element and --ply-load-default-nsegs does not fit the number of vertices
+void check_default_nsegs(size_t num_vertices) {
+    // Error if globals::ply_load_default_nsegs is not set
+    if (globals::ply_load_default_nsegs == 0) {
+        throw std::runtime_error("PLY file does not have \"strand\" element with \"nsegs\" property, and --ply-load-default-nsegs is not set");
+    }
+
+    // Error if globals::ply_load_default_nsegs is not a divisor of the number of vertices
+    if (num_vertices % (globals::ply_load_default_nsegs + 1) != 0) {
+        throw std::runtime_error("PLY file does not have \"strand\" element with \"nsegs\" property, and --ply-load-default-nsegs + 1 is not a divisor of the number of vertices");
+    }
+}
+
+// Color given to the vertices of strand i when the hair has no colors array
+std::array<unsigned char, 3> random_color(unsigned int i) {
+    UniformIntDistribution<unsigned char> uniform_dist(0, 255);
+    Philox4x32 rng(globals::seed, i);
+    const unsigned char r = uniform_dist(rng);
+    const unsigned char g = uniform_dist(rng);
+    const unsigned char b = uniform_dist(rng);
+    return { r, g, b };
+}
+
+struct PlyProperty {
+    std::string name;
+    std::string type;           // Canonical name of the type (e.g. "uchar" for "uint8"), or "list"
+    size_t size = 0;            // Size in bytes in binary formats
+    size_t offset = 0;          // Byte offset within the element record in binary formats
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t record_size = 0;     // Size in bytes of one record in binary formats
+    bool has_list = false;
+
+    const PlyProperty* find(const std::string& property_name) const {
+        for (const PlyProperty& property : properties) {
+            if (property.name == property_name)
+                return &property;
+        }
+        return nullptr;
+    }
+};
+
+struct PlyHeader {
+    std::string format;
+    std::vector<PlyElement> elements;
+    size_t data_offset = 0;     // Byte offset of the data following "end_header"
+
+    const PlyElement* find(const std::string& element_name) const {
+        for (const PlyElement& element : elements) {
+            if (element.name == element_name)
+                return &element;
+        }
+        return nullptr;
+    }
+};
+
+// Parse the header of a PLY file, or nullopt if it is not one this reader understands (left to happly)
+std::optional<PlyHeader> parse_header(const MappedFile& file) {
+    static const std::map<std::string, std::pair<std::string, size_t>> types = {
+        {"char", {"char", 1}}, {"int8", {"char", 1}},
+        {"uchar", {"uchar", 1}}, {"uint8", {"uchar", 1}},
+        {"short", {"short", 2}}, {"int16", {"short", 2}},
+        {"ushort", {"ushort", 2}}, {"uint16", {"ushort", 2}},
+        {"int", {"int", 4}}, {"int32", {"int", 4}},
+        {"uint", {"uint", 4}}, {"uint32", {"uint", 4}},
+        {"float", {"float", 4}}, {"float32", {"float", 4}},
+        {"double", {"double", 8}}, {"float64", {"double", 8}},
+    };
+
+    PlyHeader header;
+    size_t pos = 0;
+    bool first_line = true;
+    while (true) {
+        const size_t eol = std::string_view(file.data(), file.size()).find('\n', pos);
+        if (eol == std::string_view::npos)
+            return std::nullopt;
+        std::string line(file.data() + pos, eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream iss(line);
+        std::string keyword;
+        iss >> keyword;
+        if (first_line) {
+            if (keyword != "ply")
+                return std::nullopt;
+            first_line = false;
+        } else if (keyword == "format") {
+            iss >> header.format;
+        } else if (keyword == "element") {
+            PlyElement element;
+            if (!(iss >> element.name >> element.count))
+                return std::nullopt;
+            header.elements.push_back(element);
+        } else if (keyword == "property") {
+            if (header.elements.empty())
+                return std::nullopt;
+            PlyElement& element = header.elements.back();
+            PlyProperty property;
+            std::string type;
+            iss >> type;
+            if (type == "list") {
+                property.type = "list";
+                element.has_list = true;
+            } else {
+                const auto it = types.find(type);
+                if (it == types.end())
+                    return std::nullopt;
+                property.type = it->second.first;
+                property.size = it->second.second;
+                property.offset = element.record_size;
+                element.record_size += property.size;
+            }
+            // The name is the last word of the line, after the count and item types for lists
+            while (iss >> property.name) {}
+            element.properties.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        } else if (keyword != "comment" && keyword != "obj_info" && !keyword.empty()) {
+            return std::nullopt;
+        }
+    }
+    header.data_offset = pos;
+    return header;
+}
+
+// Call func(element, record, line) for every record of every element of an ASCII PLY file, one record per line.
+// Lines are found and parsed by chunks of the file in parallel, counting the line breaks of every chunk first
+// to know the index of the lines starting in it.
+void for_each_ascii_record(const MappedFile& file, const PlyHeader& header, const std::string& filename,
+                           const std::function<void(size_t, size_t, std::string_view)>& func) {
+    const std::string_view text(file.data() + header.data_offset, file.size() - header.data_offset);
+
+    // Index of the first record of every element, counting records from the start of the data
+    std::vector<size_t> element_starts = { 0 };
+    for (const PlyElement& element : header.elements)
+        element_starts.push_back(element_starts.back() + element.count);
+    const size_t num_records = element_starts.back();
+
+    // Number of lines before every chunk
+    const size_t chunk_size = 1 << 22;
+    const size_t num_chunks = (text.size() + chunk_size - 1) / chunk_size;
+    std::vector<size_t> line_offsets(num_chunks + 1, 0);
+    parallel::for_range(num_chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c)
+            line_offsets[c + 1] = std::count(text.begin() + c * chunk_size, text.begin() + std::min(text.size(), (c + 1) * chunk_size), '\n');
+    });
+    std::partial_sum(line_offsets.begin(), line_offsets.end(), line_offsets.begin());
+    const size_t num_lines = line_offsets.back() + (!text.empty() && text.back() != '\n');
+    if (num_lines < num_records) {
+        throw std::runtime_error(fmt::format("Unexpected end of file {}: {} records expected, {} lines found", filename, num_records, num_lines));
+    }
+
+    // Parse the lines starting in every chunk
+    parallel::for_range(num_chunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            const size_t chunk_end = std::min(text.size(), (c + 1) * chunk_size);
+            size_t pos = c * chunk_size;
+            size_t line = line_offsets[c];
+            if (pos > 0 && text[pos - 1] != '\n') {
+                // Skip the end of the line started in the previous chunk
+                pos = text.find('\n', pos);
+                if (pos == std::string_view::npos)
+                    continue;
+                ++pos;
+                ++line;
+            }
+            size_t element = 0;
+            for (; pos < chunk_end && line < num_records; ++line) {
+                const size_t eol = std::min(text.size(), text.find('\n', pos));
+                while (line >= element_starts[element + 1])
+                    ++element;
+                func(element, line - element_starts[element], text.substr(pos, eol - pos));
+                pos = eol + 1;
+            }
+        }
+    });
+}
+
+// Load a binary little-endian or ASCII PLY file with the hair layout straight from its mapping into the arrays of the hair,
+// or nullptr if the layout is one only happly handles (lists, or types other than those written by save_ply)
+std::shared_ptr<cyHairFile> load_ply_native(const MappedFile& file, const PlyHeader& header, const std::string& filename) {
+    const bool binary = header.format == "binary_little_endian" && std::endian::native == std::endian::little;
+    if (!binary && header.format != "ascii")
+        return nullptr;
+    for (const PlyElement& element : header.elements) {
+        if (element.has_list)
+            return nullptr;
+    }
+
+    const PlyElement* vertex = header.find("vertex");
+    if (!vertex) {
+        throw std::runtime_error("PLY file does not have \"vertex\" element");
+    }
+    const PlyProperty* x = vertex->find("x");
+    const PlyProperty* y = vertex->find("y");
+    const PlyProperty* z = vertex->find("z");
+    if (!x || !y || !z) {
+        throw std::runtime_error("PLY file does not have \"x\", \"y\", \"z\" properties");
+    }
+    const PlyProperty* red = vertex->find("red");
+    const PlyProperty* green = vertex->find("green");
+    const PlyProperty* blue = vertex->find("blue");
+    if (!red || !green || !blue)
+        red = green = blue = nullptr;
+    const PlyProperty* alpha = vertex->find("alpha");
+    const PlyProperty* thickness = vertex->find("thickness");
+    const PlyElement* strand = header.find("strand");
+    const PlyProperty* nsegs = strand ? strand->find("nsegs") : nullptr;
+
+    const auto has_type = [](const PlyProperty* property, const char* type) { return !property || property->type == type; };
+    if (!has_type(x, "float") || !has_type(y, "float") || !has_type(z, "float") ||
+        !has_type(red, "uchar") || !has_type(green, "uchar") || !has_type(blue, "uchar") ||
+        !has_type(alpha, "uchar") || !has_type(thickness, "float") || !has_type(nsegs, "ushort"))
+        return nullptr;
+
+    // Byte offset of the data of every element in binary files, all of them being made of fixed-size records
+    std::map<std::string, size_t> element_offsets;
+    if (binary) {
+        size_t offset = header.data_offset;
+        for (const PlyElement& element : header.elements) {
+            element_offsets.emplace(element.name, offset);
+            offset += element.count * element.record_size;
+        }
+        file.check_range(header.data_offset, offset - header.data_offset);
+    }
+
+    if (red) log_debug("PLY file has \"red\", \"green\", \"blue\" properties");
+    if (alpha) log_debug("PLY file has \"alpha\" property");
+    if (thickness) log_debug("PLY file has \"thickness\" property");
+    if (nsegs) log_debug("PLY file has \"strand\" element with \"nsegs\" property");
+
+    if (!nsegs)
+        check_default_nsegs(vertex->count);
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+
+    hairfile->SetArrays(
+        _CY_HAIR_FILE_POINTS_BIT |
+        (nsegs ? _CY_HAIR_FILE_SEGMENTS_BIT : 0) |
+        (red ? _CY_HAIR_FILE_COLORS_BIT : 0) |
+        (alpha ? _CY_HAIR_FILE_TRANSPARENCY_BIT : 0) |
+        (thickness ? _CY_HAIR_FILE_THICKNESS_BIT : 0)
+    );
+
+    hairfile->SetHairCount(nsegs ? strand->count : (vertex->count / (globals::ply_load_default_nsegs + 1)));
+    hairfile->SetPointCount(vertex->count);
+    if (!nsegs)
+        hairfile->SetDefaultSegmentCount(globals::ply_load_default_nsegs);
+
+    // Set vertex i from the values of its properties, get_float/get_uchar(property) giving those of float/uchar properties
+    const auto set_vertex = [&](size_t i, const auto& get_float, const auto& get_uchar) {
+        hairfile->GetPointsArray()[i * 3 + 0] = get_float(x);
+        hairfile->GetPointsArray()[i * 3 + 1] = get_float(y);
+        hairfile->GetPointsArray()[i * 3 + 2] = get_float(z);
+        if (red) {
+            hairfile->GetColorsArray()[i * 3 + 0] = get_uchar(red) / 255.0f;
+            hairfile->GetColorsArray()[i * 3 + 1] = get_uchar(green) / 255.0f;
+            hairfile->GetColorsArray()[i * 3 + 2] = get_uchar(blue) / 255.0f;
+        }
+        if (alpha)
+            hairfile->GetTransparencyArray()[i] = get_uchar(alpha) / 255.0f;
+        if (thickness)
+            hairfile->GetThicknessArray()[i] = get_float(thickness);
+    };
+
+    if (binary) {
+        // Copy every property from its place in the vertex records, vertices in parallel
+        const char* vertex_data = file.data() + element_offsets.at("vertex");
+        parallel::for_range(vertex->count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const char* record = vertex_data + i * vertex->record_size;
+                set_vertex(i,
+                    [&](const PlyProperty* property) { float value; std::memcpy(&value, record + property->offset, sizeof(float)); return value; },
+                    [&](const PlyProperty* property) { return static_cast<unsigned char>(record[property->offset]); });
+            }
+        });
+
+        // Copy segments array if available
+        if (nsegs) {
+            const char* strand_data = file.data() + element_offsets.at("strand");
+            for (size_t i = 0; i < strand->count; ++i)
+                std::memcpy(&hairfile->GetSegmentsArray()[i], strand_data + i * strand->record_size + nsegs->offset, sizeof(unsigned short));
+        }
+    } else {
+        // Parse the values of the vertex and strand records, up to the last property in use
+        const auto parse_values = [&](std::string_view line, std::vector<float>& values) {
+            const char* p = line.data();
+            const char* end = line.data() + line.size();
+            for (float& value : values) {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                    ++p;
+                const auto [ptr, ec] = std::from_chars(p, end, value);
+                if (ec != std::errc()) {
+                    throw std::runtime_error(fmt::format("Invalid record in {}: '{}'", filename, line));
+                }
+                p = ptr;
+            }
+        };
+        const auto index = [](const PlyElement* element, const PlyProperty* property) { return property ? property - element->properties.data() : 0; };
+        const size_t num_vertex_values = 1 + std::max({ index(vertex, x), index(vertex, y), index(vertex, z), index(vertex, red), index(vertex, green), index(vertex, blue), index(vertex, alpha), index(vertex, thickness) });
+        const size_t vertex_element = vertex - header.elements.data();
+        const size_t strand_element = strand ? strand - header.elements.data() : header.elements.size();
+
+        for_each_ascii_record(file, header, filename, [&](size_t element, size_t record, std::string_view line) {
+            thread_local std::vector<float> values;
+            if (element == vertex_element) {
+                values.resize(num_vertex_values);
+                parse_values(line, values);
+                const auto get = [&](const PlyProperty* property) { return values[index(vertex, property)]; };
+                set_vertex(record, get, get);
+            } else if (element == strand_element && nsegs) {
+                values.resize(index(strand, nsegs) + 1);
+                parse_values(line, values);
+                hairfile->GetSegmentsArray()[record] = static_cast<unsigned short>(values.back());
+            }
+        });
+    }
+
+    return hairfile;
+}
+
+// Call format_block(buffer, begin, end) to format consecutive blocks of strands into buffers of their own in parallel,
+// and write the buffers to ofs in order. Strands are processed in batches so that the buffers do not hold the whole file at once.
+void write_blocks(std::ofstream& ofs, unsigned int hair_count, const std::function<void(std::string&, unsigned int, unsigned int)>& format_block) {
+    const unsigned int block_size = 4096;
+    const unsigned int batch_size = 64 * block_size;
+    std::vector<std::string> buffers;
+    for (unsigned int batch_begin = 0; batch_begin < hair_count; batch_begin += batch_size) {
+        const unsigned int batch_end = std::min(hair_count, batch_begin + batch_size);
+        buffers.resize((batch_end - batch_begin + block_size - 1) / block_size);
+        parallel::for_range(buffers.size(), [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                buffers[b].clear();
+                const unsigned int block_begin = batch_begin + b * block_size;
+                format_block(buffers[b], block_begin, std::min(batch_end, block_begin + block_size));
+            }
+        });
+        for (const std::string& buffer : buffers)
+            ofs.write(buffer.data(), buffer.size());
+    }
+}
+
+// Write a binary little-endian or ASCII PLY file with the hair layout, formatting the records from the arrays of the hair
+void save_ply_native(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile, bool ascii) {
+    const auto& header = hairfile->GetHeader();
+    const bool has_colors = (header.arrays & _CY_HAIR_FILE_COLORS_BIT) || !globals::ply_save_minimal;
+    const bool random_colors = !(header.arrays & _CY_HAIR_FILE_COLORS_BIT) && has_colors;
+    const bool has_alpha = header.arrays & _CY_HAIR_FILE_TRANSPARENCY_BIT;
+    const bool has_thickness = header.arrays & _CY_HAIR_FILE_THICKNESS_BIT;
+    const bool has_edges = !globals::ply_save_minimal;
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+    const unsigned int num_edges = header.point_count - header.hair_count;
+
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+
+    if (!ofs.is_open()) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    }
+
+    ofs << "ply\n";
+    ofs << (ascii ? "format ascii 1.0\n" : "format binary_little_endian 1.0\n");
+    ofs << "element vertex " << header.point_count << "\n";
+    ofs << "property float x\n";
+    ofs << "property float y\n";
+    ofs << "property float z\n";
+    if (has_colors) {
+        ofs << "property uchar red\n";
+        ofs << "property uchar green\n";
+        ofs << "property uchar blue\n";
+    }
+    if (has_alpha) ofs << "property uchar alpha\n";
+    if (has_thickness) ofs << "property float thickness\n";
+    ofs << "element strand " << header.hair_count << "\n";
+    ofs << "property ushort nsegs\n";
+    if (has_edges) {
+        ofs << "element edge " << num_edges << "\n";
+        ofs << "property int vertex1\n";
+        ofs << "property int vertex2\n";
+    }
+    ofs << "end_header\n";
+
+    // Append a value to the record being formatted in buffer: its bytes, or its shortest text that reads back to the same value
+    const auto append = [ascii](std::string& buffer, const auto value) {
+        if (!ascii) {
+            buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        } else {
+            if (!buffer.empty() && buffer.back() != '\n')
+                buffer += ' ';
+            if constexpr (std::is_same_v<decltype(value), const unsigned char>)
+                fmt::format_to(std::back_inserter(buffer), "{}", static_cast<unsigned int>(value));
+            else
+                fmt::format_to(std::back_inserter(buffer), "{}", value);
+        }
+    };
+    const auto end_record = [ascii](std::string& buffer) {
+        if (ascii)
+            buffer += '\n';
+    };
+
+    // Vertex records, by strands so that the random colors are drawn once per strand
+    write_blocks(ofs, header.hair_count, [&](std::string& buffer, unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; ++i) {
+            const std::array<unsigned char, 3> color = random_colors ? random_color(i) : std::array<unsigned char, 3>{};
+            for (unsigned int k = offsets[i]; k < offsets[i + 1]; ++k) {
+                for (unsigned int c = 0; c < 3; ++c)
+                    append(buffer, hairfile->GetPointsArray()[k * 3 + c]);
+                for (unsigned int c = 0; has_colors && c < 3; ++c)
+                    append(buffer, random_colors ? color[c] : static_cast<unsigned char>(hairfile->GetColorsArray()[k * 3 + c] * 255));
+                if (has_alpha)
+                    append(buffer, static_cast<unsigned char>(hairfile->GetTransparencyArray()[k] * 255));
+                if (has_thickness)
+                    append(buffer, hairfile->GetThicknessArray()[k]);
+                end_record(buffer);
+            }
+        }
+    });
+
+    // Strand records, straight from the segments array if available in binary files
+    if (!ascii && (header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT)) {
+        ofs.write(reinterpret_cast<const char*>(hairfile->GetSegmentsArray()), header.hair_count * sizeof(unsigned short));
+    } else {
+        write_blocks(ofs, header.hair_count, [&](std::string& buffer, unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i) {
+                append(buffer, static_cast<unsigned short>(offsets[i + 1] - offsets[i] - 1));
+                end_record(buffer);
+            }
+        });
+    }
+
+    // Edge records, joining every vertex to the next one in its strand
+    if (has_edges) {
+        write_blocks(ofs, header.hair_count, [&](std::string& buffer, unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i) {
+                for (int k = offsets[i]; k + 1 < (int)offsets[i + 1]; ++k) {
+                    append(buffer, k);
+                    append(buffer, k + 1);
+                    end_record(buffer);
+                }
+            }
+        });
+    }
+}
+
+std::shared_ptr<cyHairFile> load_ply_happly(const std::string &filename) {
     happly::PLYData ply(filename);
 
     // Error if it doesn't have "vertex" element
@@ -55,17 +510,8 @@ std::shared_ptr<cyHairFile> io::load_ply(const std::string &filename) {
     }
 
     // Error checking when segments_array is empty
-    if (segments_array.empty()) {
-        // Error if globals::ply_load_default_nsegs is not set
-        if (globals::ply_load_default_nsegs == 0) {
-            throw std::runtime_error("PLY file does not have \"strand\" element with \"nsegs\" property, and --ply-load-default-nsegs is not set");
-        }
-
-        // Error if globals::ply_load_default_nsegs is not a divisor of the number of vertices
-        if (vertex_x.size() % (globals::ply_load_default_nsegs + 1) != 0) {
-            throw std::runtime_error("PLY file does not have \"strand\" element with \"nsegs\" property, and --ply-load-default-nsegs + 1 is not a divisor of the number of vertices");
-        }
-    }
+    if (segments_array.empty())
+        check_default_nsegs(vertex_x.size());
 
     std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
 
@@ -114,7 +560,7 @@ std::shared_ptr<cyHairFile> io::load_ply(const std::string &filename) {
     return hairfile;
 }
 
-void io::save_ply(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
+void save_ply_happly(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
     const auto& header = hairfile->GetHeader();
 
     // Create arrays for "vertex" element
@@ -148,19 +594,16 @@ void io::save_ply(const std::string &filename, const std::shared_ptr<cyHairFile>
     }
 
     // If color is not available, assign random value per strand
-    if (vertex_red.empty()) {
-        UniformIntDistribution<unsigned char> uniform_dist(0, 255);
-        for (unsigned int i = 0; i < header.hair_count; ++i) {
-            const unsigned short nsegs = header.arrays & _CY_HAIR_FILE_SEGMENTS_BIT ? hairfile->GetSegmentsArray()[i] : header.d_segments;
-
-            const unsigned char r = uniform_dist(globals::rng);
-            const unsigned char g = uniform_dist(globals::rng);
-            const unsigned char b = uniform_dist(globals::rng);
-
-            vertex_red.resize(vertex_red.size() + nsegs + 1, r);
-            vertex_green.resize(vertex_green.size() + nsegs + 1, g);
-            vertex_blue.resize(vertex_blue.size() + nsegs + 1, b);
-        }
+    if (vertex_red.empty() && !globals::ply_save_minimal) {
+        vertex_red.resize(header.point_count);
+        vertex_green.resize(header.point_count);
+        vertex_blue.resize(header.point_count);
+        parallel::for_each_strand(*hairfile, [&](unsigned int i, size_t offset, size_t nsegs) {
+            const std::array<unsigned char, 3> color = random_color(i);
+            std::fill_n(vertex_red.begin() + offset, nsegs + 1, color[0]);
+            std::fill_n(vertex_green.begin() + offset, nsegs + 1, color[1]);
+            std::fill_n(vertex_blue.begin() + offset, nsegs + 1, color[2]);
+        });
     }
 
     // Create array for "strand" element
@@ -201,23 +644,46 @@ void io::save_ply(const std::string &filename, const std::shared_ptr<cyHairFile>
     ply.addElement("strand", header.hair_count);
     ply.getElement("strand").addProperty<unsigned short>("nsegs", segments_array);
 
-    std::vector<int> edge_vertex1;      edge_vertex1.reserve(vertex_x.size());
-    std::vector<int> edge_vertex2;      edge_vertex2.reserve(vertex_x.size());
+    if (!globals::ply_save_minimal) {
+        std::vector<int> edge_vertex1;      edge_vertex1.reserve(vertex_x.size());
+        std::vector<int> edge_vertex2;      edge_vertex2.reserve(vertex_x.size());
 
-    int point_idx = 0;
-    for (unsigned int i = 0; i < header.hair_count; ++i) {
-        for (unsigned int j = 0; j < segments_array[i]; ++j) {
-            edge_vertex1.push_back(point_idx);
-            edge_vertex2.push_back(point_idx + 1);
+        int point_idx = 0;
+        for (unsigned int i = 0; i < header.hair_count; ++i) {
+            for (unsigned int j = 0; j < segments_array[i]; ++j) {
+                edge_vertex1.push_back(point_idx);
+                edge_vertex2.push_back(point_idx + 1);
+                ++point_idx;
+            }
             ++point_idx;
         }
-        ++point_idx;
-    }
 
-    ply.addElement("edge", std::accumulate(segments_array.begin(), segments_array.end(), 0));
-    ply.getElement("edge").addProperty<int>("vertex1", edge_vertex1);
-    ply.getElement("edge").addProperty<int>("vertex2", edge_vertex2);
+        ply.addElement("edge", std::accumulate(segments_array.begin(), segments_array.end(), 0));
+        ply.getElement("edge").addProperty<int>("vertex1", edge_vertex1);
+        ply.getElement("edge").addProperty<int>("vertex2", edge_vertex2);
+    }
 
     // Write to file
     ply.write(filename, globals::ply_save_ascii ? happly::DataFormat::ASCII : happly::DataFormat::Binary);
 }
+
+}
+
+std::shared_ptr<cyHairFile> io::load_ply(const std::string &filename) {
+    {
+        const MappedFile file(filename);
+        if (const std::optional<PlyHeader> header = parse_header(file)) {
+            if (std::shared_ptr<cyHairFile> hairfile = load_ply_native(file, *header, filename))
+                return hairfile;
+        }
+    }
+    log_debug("Loading {} with happly", filename);
+    return load_ply_happly(filename);
+}
+
+void io::save_ply(const std::string &filename, const std::shared_ptr<cyHairFile> &hairfile) {
+    if (!globals::ply_save_ascii && std::endian::native != std::endian::little)
+        save_ply_happly(filename, hairfile);
+    else
+        save_ply_native(filename, hairfile, globals::ply_save_ascii);
+}
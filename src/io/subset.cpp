@@ -0,0 +1,43 @@
+#include "io.h"
+
+void io::save_subset(const std::string &filename, const std::string &ext, const HairSubset &subset) {
+    const std::unordered_map<std::string, std::function<void(const std::string&, const HairSubset&)>> subset_writers = {
+        {"bin", save_bin_subset},
+        {"hair", save_hair_subset},
+        {"data", save_data_subset},
+    };
+    if (subset_writers.count(ext))
+        subset_writers.at(ext)(filename, subset);
+    else
+        globals::supported_ext.at(ext).second(filename, subset.materialize());
+}
+
+std::shared_ptr<cyHairFile> io::load_subset(const std::string &filename, const std::string &ext, const strand_ranges_t &ranges) {
+    const std::unordered_map<std::string, std::function<std::shared_ptr<cyHairFile>(const std::string&, const strand_ranges_t&)>> subset_loaders = {
+        {"bin", load_bin_subset},
+        {"hair", load_hair_subset},
+        {"data", load_data_subset},
+        {"npy", load_npy_subset},
+        {"hzc", load_hzc_subset},
+        {"h5", load_h5_subset},
+    };
+    if (subset_loaders.count(ext))
+        return subset_loaders.at(ext)(filename, ranges);
+
+    const std::shared_ptr<cyHairFile> hairfile = globals::supported_ext.at(ext).first(filename);
+    check_strand_ranges(ranges, hairfile->GetHeader().hair_count, filename);
+    std::vector<unsigned int> indices;
+    for (const auto& [begin, end] : ranges) {
+        for (unsigned int i = begin; i < end; ++i)
+            indices.push_back(i);
+    }
+    return HairSubset(hairfile, std::move(indices)).materialize();
+}
+
+void io::check_strand_ranges(const strand_ranges_t &ranges, unsigned int hair_count, const std::string &filename) {
+    for (const auto& [begin, end] : ranges) {
+        if (begin > end || end > hair_count) {
+            throw std::runtime_error(fmt::format("Invalid strand range [{}, {}) of {} strands in {}", begin, end, hair_count, filename));
+        }
+    }
+}
@@ -1,14 +1,74 @@
+#include <atomic>
 #include <ctime>
+#include <thread>
 
 #include "cmd.h"
 #include "io.h"
+#include "parallel.h"
 #include "util.h"
 
-#ifdef TEST_MODE
-int test_main(int argc, const char **argv)
-#else
-int main(int argc, const char **argv)
-#endif
+namespace {
+
+int run(int argc, const char **argv, nlohmann::json* report);
+
+// Command line with the value of --input-file replaced
+std::vector<std::string> replace_input_file(int argc, const char **argv, const std::string& input_file) {
+    std::vector<std::string> args(argv, argv + argc);
+    for (size_t i = 1; i < args.size(); ++i) {
+        std::string& arg = args[i];
+        if (arg == "--")
+            break;
+        if ((arg == "-i" || arg == "--input-file") && i + 1 < args.size())
+            args[++i] = input_file;
+        else if (arg.starts_with("--input-file="))
+            arg = "--input-file=" + input_file;
+        else if (arg.starts_with("-i"))
+            arg = "-i" + input_file;
+    }
+    return args;
+}
+
+// Run the same command line for every input file concurrently, each thread with its own globals::State
+int run_batch(int argc, const char **argv, const std::vector<std::string>& input_files) {
+    log_info("Processing {} files in batch mode", input_files.size());
+
+    std::vector<nlohmann::json> reports(input_files.size());
+    std::vector<int> results(input_files.size(), 1);
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads(std::min<size_t>(parallel::num_threads(), input_files.size()));
+    for (std::thread& thread : threads) {
+        thread = std::thread([&]{
+            globals::State state;
+            globals::use_thread_state(state);
+            for (size_t k; (k = next++) < input_files.size(); ) {
+                const std::vector<std::string> args = replace_input_file(argc, argv, input_files[k]);
+                std::vector<const char*> args_c;
+                for (const std::string& arg : args)
+                    args_c.push_back(arg.c_str());
+                globals::clear();
+                results[k] = run(args_c.size(), args_c.data(), &reports[k]);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    cmd::clear_mesh_cache();
+
+    const size_t num_failed = std::count_if(results.begin(), results.end(), [](int result) { return result != 0; });
+    for (size_t k = 0; k < input_files.size(); ++k) {
+        if (results[k] != 0)
+            log_error("Failed to process {}", input_files[k]);
+    }
+    globals::json["batch"]["num_files"] = input_files.size();
+    globals::json["batch"]["num_failed"] = num_failed;
+    globals::json["batch"]["files"] = reports;
+    log_info("Processed {} files ({} failed)", input_files.size(), num_failed);
+    return num_failed ? 1 : 0;
+}
+
+// Process the input file given in the command line, or every file of a batch.
+// For a file of a batch, the JSON log is moved to report rather than printed.
+int run(int argc, const char **argv, nlohmann::json* report)
 {
     args::ArgumentParser parser(fmt::format(
         "A command-line tool for handling hair files (version: {})\n"
@@ -19,7 +79,9 @@ int main(int argc, const char **argv)
         "  .ply\n"
         "  .ma\n"
         "  .abc\n"
-        "  .npy", globals::VERSIONTAG));
+        "  .npy\n"
+        "  .hzc\n"
+        "  .h5", globals::VERSIONTAG));
     parser.helpParams.width = 120;
     parser.helpParams.helpindent = 32;
 
@@ -31,6 +93,7 @@ int main(int argc, const char **argv)
     args::Command cmd_findpenet(grp_commands, "findpenet", "Find penetration against head mesh", cmd::parse::findpenet);
     args::Command cmd_getcurvature(grp_commands, "getcurvature", "Get discrete curvature & torsion", cmd::parse::getcurvature);
     args::Command cmd_info(grp_commands, "info", "Print information", cmd::parse::info);
+    args::Command cmd_pipe(grp_commands, "pipe", "Run several commands in sequence, keeping strands in memory between them", cmd::parse::pipe);
     args::Command cmd_resample(grp_commands, "resample", "Resample strands s.t. every segment is shorter than twice the target segment length", cmd::parse::resample);
     args::Command cmd_smooth(grp_commands, "smooth", "Smooth strands", cmd::parse::smooth);
     args::Command cmd_stats(grp_commands, "stats", "Generate statistics", cmd::parse::stats);
@@ -39,16 +102,21 @@ int main(int argc, const char **argv)
     args::Command cmd_tubify(grp_commands, "tubify", "Turn curves into tubes as triangle mesh", cmd::parse::tubify);
 
     args::Group grp_globals("Common options:");
-    args::ValueFlag<std::string> globals_input_file(grp_globals, "PATH", "(REQUIRED) Input file", {'i', "input-file"}, args::Options::Required);
+    args::ValueFlag<std::string> globals_input_file(grp_globals, "PATH", "(REQUIRED) Input file, or a .txt file listing input files or a wildcard pattern (e.g. 'dir/*.bin') for batch mode", {'i', "input-file"}, args::Options::Required);
     args::ValueFlag<std::string> globals_output_ext(grp_globals, "EXT", "Output file extension (or extensions by comma-delimited list); when omitted, use input file extension", {'o', "output-ext"}, "");
     args::Flag globals_overwrite(grp_globals, "overwrite", "Overwrite when output file exists", {"overwrite"});
     args::ValueFlag<std::string> globals_output_dir(grp_globals, "DIR", "Output directory; if not specified, same as the input file", {'d', "output-dir"}, "");
     args::ValueFlag<unsigned int> globals_ply_load_default_nsegs(grp_globals, "N", "Default number of segments per strand for PLY files [0]", {"ply-load-default-nsegs"}, 0);
     args::Flag globals_ply_save_ascii(grp_globals, "ply-save-ascii", "Save PLY files in ASCII format", {"ply-save-ascii"});
+    args::ValueFlag<std::string> globals_ply_profile(grp_globals, "NAME", "Layout of saved PLY files {full,minimal}; minimal leaves out the edge element and random vertex colors [full]", {"ply-profile"}, "full");
+    args::ValueFlag<float> globals_hzc_error(grp_globals, "E", "Maximum absolute error of the values in saved HZC files (0 for lossless) [1e-4]", {"hzc-error"}, 1e-4f);
+    args::ValueFlag<unsigned int> globals_hzc_deflate_level(grp_globals, "N", "zlib compression level of saved HZC files (0 for no compression) [6]", {"hzc-deflate-level"}, 6);
+    args::ValueFlag<std::string> globals_strands(grp_globals, "LIST", "Load only the strands with these indices, as comma-separated indices and inclusive ranges (e.g. '1000-2000,5000'); commands then see the loaded strands only, numbered from 0", {"strands"}, "");
     args::ValueFlag<std::string> globals_verbosity(grp_globals, "NAME", "Verbosity level name {trace,debug,info,warn,error,critical,off} [info]", {'v', "verbosity"}, "info");
     args::Flag globals_print_json(grp_globals, "print-json", "Print log messages in JSON format, disabling standard logging", {'j', "print-json"});
     args::ValueFlag<int> globals_seed(grp_globals, "N", "Seed for random number generator (-1 for time-based seed) [0]", {"seed"}, 0);
     args::Flag globals_no_autofix(grp_globals, "no-autofix", "Do not auto-fix issues in input", {"no-autofix"});
+    args::ValueFlag<unsigned int> globals_threads(grp_globals, "N", "Number of threads for per-strand processing, or for files in batch mode (0 for all hardware threads) [0]", {"threads"}, 0);
     args::HelpFlag globals_help(grp_globals, "help", "Show this help message", {'h', "help"});
 
     args::GlobalOptions global_options(parser, grp_globals);
@@ -91,8 +159,15 @@ int main(int argc, const char **argv)
         }
     }
     auto scope_guard = sg::make_scope_guard([&]{
-        if (globals_print_json)
+        if (report) {
+            *report = std::move(globals::json);
+        } else if (globals_print_json) {
+            if (!globals::thread_busy_time.empty()) {
+                globals::json["threads"]["num_threads"] = parallel::num_threads();
+                globals::json["threads"]["busy_time"] = globals::thread_busy_time;
+            }
             cout << globals::json.dump(2) << std::endl;
+        }
     });
     spdlog::set_level(
         *globals_verbosity == "trace" ? spdlog::level::trace :
@@ -104,19 +179,56 @@ int main(int argc, const char **argv)
     );
 
     globals::input_file = *globals_input_file;
-    globals::output_exts = util::container_cast<std::set<std::string>>(util::parse_comma_separated_values<std::string>(*globals_output_ext));
+    if (globals_output_ext)
+        globals::output_exts = util::container_cast<std::set<std::string>>(util::parse_comma_separated_values<std::string>(*globals_output_ext));
     globals::output_dir = *globals_output_dir;
     globals::overwrite = globals_overwrite;
     globals::ply_load_default_nsegs = *globals_ply_load_default_nsegs;
     globals::ply_save_ascii = globals_ply_save_ascii;
+    if (*globals_ply_profile != "full" && *globals_ply_profile != "minimal") {
+        log_error("Invalid PLY profile: {}", *globals_ply_profile);
+        return 1;
+    }
+    globals::ply_save_minimal = *globals_ply_profile == "minimal";
+    if (*globals_hzc_error < 0.0f) {
+        log_error("Invalid HZC error: {}", *globals_hzc_error);
+        return 1;
+    }
+    globals::hzc_error = *globals_hzc_error;
+    if (*globals_hzc_deflate_level > 9) {
+        log_error("Invalid HZC deflate level: {}", *globals_hzc_deflate_level);
+        return 1;
+    }
+    globals::hzc_deflate_level = *globals_hzc_deflate_level;
+    if (globals_strands) {
+        try {
+            globals::strands = util::parse_strand_ranges(*globals_strands);
+        } catch (const std::exception &e) {
+            log_error("{}", e.what());
+            return 1;
+        }
+    }
+    globals::num_threads = *globals_threads;
 
-    // Seed the random number generator
+    // Seed the random number generators
     int seed = *globals_seed;
     if (seed < 0) {
         seed = std::time(nullptr);
         log_info("Using time-based seed: {}", seed);
     }
-    globals::rng.seed(seed);
+    globals::seed = seed;
+
+    // Batch mode, when given a list file or a wildcard pattern as input
+    if (!report && util::is_batch_input(globals::input_file)) {
+        std::vector<std::string> input_files;
+        try {
+            input_files = util::list_batch_input_files(globals::input_file);
+        } catch (const std::exception &e) {
+            log_error("{}", e.what());
+            return 1;
+        }
+        return run_batch(argc, argv, input_files);
+    }
 
     // Get file extension from globals::input_file, in lowercase
     globals::input_ext = globals::input_file.substr(globals::input_file.find_last_of(".") + 1);
@@ -190,6 +302,13 @@ int main(int argc, const char **argv)
                 log_error("Use --overwrite to overwrite the file");
                 return 1;
             }
+
+            // Strand offsets, saved next to .npy files of strands with different numbers of segments
+            if (output_ext == "npy" && !globals::overwrite && std::filesystem::exists(io::npy_offsets_filename(output_files[output_ext]))) {
+                log_error("Output file already exists: {}", io::npy_offsets_filename(output_files[output_ext]));
+                log_error("Use --overwrite to overwrite the file");
+                return 1;
+            }
         }
     }
 
@@ -201,7 +320,7 @@ int main(int argc, const char **argv)
 
         log_info("Loading from {} ...", globals::input_file);
         globals::json["input"]["file"] = globals::input_file;
-        auto hairfile_in = load_func(globals::input_file);
+        auto hairfile_in = globals::strands.empty() ? load_func(globals::input_file) : io::load_subset(globals::input_file, globals::input_ext, globals::strands);
 
         // Auto-fix issues in input
         if (!globals_no_autofix && globals::cmd_exec != cmd::exec::autofix) {
@@ -217,15 +336,22 @@ int main(int argc, const char **argv)
 
         auto hairfile_out = globals::cmd_exec(hairfile_in);
 
-        if (hairfile_out) {
+        // Commands selecting strands output a view of them, saved without copying them into a hair of their own
+        const std::shared_ptr<const HairSubset> subset_out = std::move(globals::output_subset);
+        if (hairfile_out || subset_out) {
             globals::json["output"]["file"] = nlohmann::json::array();
-            globals::json["output"]["num_strands"] = hairfile_out->GetHeader().hair_count;
-            globals::json["output"]["num_points"] = hairfile_out->GetHeader().point_count;
+            globals::json["output"]["num_strands"] = subset_out ? subset_out->hair_count() : hairfile_out->GetHeader().hair_count;
+            globals::json["output"]["num_points"] = subset_out ? subset_out->point_count() : hairfile_out->GetHeader().point_count;
             for (const auto& [output_ext, output_file] : output_files) {
                 const auto save_func = globals::supported_ext.at(output_ext).second;
                 log_info("Saving to {} ...", output_file);
                 globals::json["output"]["file"].push_back(output_file);
-                save_func(output_file, hairfile_out);
+                if (subset_out)
+                    io::save_subset(output_file, output_ext, *subset_out);
+                else
+                    save_func(output_file, hairfile_out);
+                if (output_ext == "npy" && std::filesystem::exists(io::npy_offsets_filename(output_file)))
+                    globals::json["output"]["file"].push_back(io::npy_offsets_filename(output_file));
             }
         }
     }
@@ -238,3 +364,14 @@ int main(int argc, const char **argv)
     log_info("Done");
     return 0;
 }
+
+}
+
+#ifdef TEST_MODE
+int test_main(int argc, const char **argv)
+#else
+int main(int argc, const char **argv)
+#endif
+{
+    return run(argc, argv, nullptr);
+}
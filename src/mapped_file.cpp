@@ -0,0 +1,126 @@
+#include "mapped_file.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& filename, bool copy_on_write) : filename(filename) {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    }
+    auto scope_guard = sg::make_scope_guard([fd]{ ::close(fd); });
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw std::runtime_error(fmt::format("Cannot get size of file {}", filename));
+    }
+    size_ = st.st_size;
+
+    // mmap does not accept empty ranges
+    if (size_ == 0)
+        return;
+
+    void* addr = ::mmap(nullptr, size_, PROT_READ | (copy_on_write ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error(fmt::format("Cannot map file {}", filename));
+    }
+    data_ = static_cast<char*>(addr);
+}
+
+MappedFile::~MappedFile() {
+    if (data_)
+        ::munmap(data_, size_);
+}
+
+void MappedFile::check_range(size_t pos, size_t count) const {
+    if (pos > size_ || count > size_ - pos) {
+        throw std::runtime_error(fmt::format("Unexpected end of file {} (reading {} bytes at offset {} of {})", filename, count, pos, size_));
+    }
+}
+
+MappedOutputFile::MappedOutputFile(const std::string& filename, size_t size) : filename(filename), temp_filename(filename + ".tmp"), size_(size) {
+    const int fd = ::open(temp_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", temp_filename));
+    }
+    auto scope_guard = sg::make_scope_guard([fd]{ ::close(fd); });
+
+    try {
+        // Reserve the blocks up front, so that running out of space fails here rather than as SIGBUS on writing to the mapping
+        if (size_ == 0)
+            return;
+        const int err = ::posix_fallocate(fd, 0, size_);
+        if (err != 0) {
+            throw std::runtime_error(fmt::format("Cannot allocate {} bytes for file {}: {}", size_, filename, std::strerror(err)));
+        }
+
+        void* addr = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error(fmt::format("Cannot map file {}", filename));
+        }
+        data_ = static_cast<char*>(addr);
+    } catch (...) {
+        ::unlink(temp_filename.c_str());
+        throw;
+    }
+}
+
+MappedOutputFile::~MappedOutputFile() {
+    if (data_)
+        ::munmap(data_, size_);
+    if (!committed)
+        ::unlink(temp_filename.c_str());
+}
+
+void MappedOutputFile::commit() {
+    if (data_) {
+        if (::msync(data_, size_, MS_SYNC) != 0) {
+            throw std::runtime_error(fmt::format("Cannot write file {}: {}", filename, std::strerror(errno)));
+        }
+        ::munmap(data_, size_);
+        data_ = nullptr;
+    }
+    if (::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error(fmt::format("Cannot move {} to {}: {}", temp_filename, filename, std::strerror(errno)));
+    }
+    committed = true;
+}
+
+RandomAccessFile::RandomAccessFile(const std::string& filename) : filename(filename) {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format("Cannot open file {}", filename));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format("Cannot get size of file {}", filename));
+    }
+    size_ = st.st_size;
+}
+
+RandomAccessFile::~RandomAccessFile() {
+    ::close(fd);
+}
+
+void RandomAccessFile::read(size_t pos, size_t count, void* dst) const {
+    if (pos > size_ || count > size_ - pos) {
+        throw std::runtime_error(fmt::format("Unexpected end of file {} (reading {} bytes at offset {} of {})", filename, count, pos, size_));
+    }
+    // pread may return fewer bytes than asked for
+    char* out = static_cast<char*>(dst);
+    while (count > 0) {
+        const ssize_t n = ::pread(fd, out, count, pos);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            throw std::runtime_error(fmt::format("Cannot read {} bytes at offset {} of file {}", count, pos, filename));
+        }
+        out += n;
+        pos += n;
+        count -= n;
+    }
+}
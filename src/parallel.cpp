@@ -0,0 +1,238 @@
+#include "parallel.h"
+#include "api.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Persistent pool of worker threads; the calling thread takes part as thread 0
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int num_threads) {
+        for (unsigned int i = 1; i < num_threads; ++i)
+            workers.emplace_back([this, i]{ worker_loop(i); });
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_start.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    unsigned int size() const { return workers.size() + 1; }
+
+    // Run task(thread_idx) on every thread of the pool and wait for all of them to return
+    void run(const std::function<void(unsigned int)>& task_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &task_;
+            num_pending = workers.size();
+            ++generation;
+        }
+        cv_start.notify_all();
+        task_(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [this]{ return num_pending == 0; });
+        task = nullptr;
+    }
+
+private:
+    void worker_loop(unsigned int thread_idx) {
+        size_t last_generation = 0;
+        while (true) {
+            const std::function<void(unsigned int)>* task_;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv_start.wait(lock, [&]{ return stop || generation != last_generation; });
+                if (stop)
+                    return;
+                last_generation = generation;
+                task_ = task;
+            }
+            (*task_)(thread_idx);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--num_pending == 0)
+                    cv_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+    const std::function<void(unsigned int)>* task = nullptr;
+    size_t generation = 0;
+    size_t num_pending = 0;
+    bool stop = false;
+};
+
+std::mutex pool_mutex;                  // Held by the thread whose parallel region runs on the pool
+std::mutex busy_time_mutex;             // Guards the busy time vectors, which pool threads add to
+std::unique_ptr<ThreadPool> pool;
+thread_local bool in_parallel_region = false;
+
+// Number of tasks per thread to cut the work into, leaving room for stealing
+const size_t tasks_per_thread = 16;
+
+// Tasks owned by one thread: the owner pops from the front, other threads steal from the back
+struct TaskQueue {
+    std::mutex mutex;
+    size_t front = 0;
+    size_t back = 0;
+
+    bool pop_front(size_t& task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (front == back)
+            return false;
+        task = front++;
+        return true;
+    }
+    bool steal_back(size_t& task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (front == back)
+            return false;
+        task = --back;
+        return true;
+    }
+};
+
+// Call func(bounds[k], bounds[k+1]) for every task k, scheduled over the thread pool with work stealing
+void run_tasks(const std::vector<size_t>& bounds, const std::function<void(size_t, size_t)>& func) {
+    using clock = std::chrono::steady_clock;
+
+    const size_t num_tasks = bounds.size() - 1;
+    const unsigned int num_threads_ = parallel::num_threads();
+    // Busy time of the calling thread's context if any, else of its state, which the pool threads add to as well
+    std::vector<double>& busy_time = globals::context ? globals::context->thread_busy_time : globals::thread_busy_time;
+    const auto run_serial = [&]{
+        const auto start = clock::now();
+        func(bounds.front(), bounds.back());
+        if (!in_parallel_region) {
+            std::lock_guard<std::mutex> lock(busy_time_mutex);
+            if (busy_time.empty())
+                busy_time.resize(1);
+            busy_time[0] += std::chrono::duration<double>(clock::now() - start).count();
+        }
+    };
+    if (num_threads_ == 1 || num_tasks == 1 || in_parallel_region || globals::has_thread_state()) {
+        run_serial();
+        return;
+    }
+
+    // If another thread's region (e.g. a concurrent library call) occupies the pool, do not wait for it
+    std::unique_lock<std::mutex> lock(pool_mutex, std::try_to_lock);
+    if (!lock) {
+        run_serial();
+        return;
+    }
+    // Keep num_threads() workers whatever the number of tasks, rebuilding the pool only when the number of threads changes
+    if (!pool || pool->size() != num_threads_)
+        pool = std::make_unique<ThreadPool>(num_threads_);
+    {
+        std::lock_guard<std::mutex> lock(busy_time_mutex);
+        if (busy_time.size() < num_threads_)
+            busy_time.resize(num_threads_);
+    }
+
+    // Every active thread starts with a contiguous block of tasks; with fewer tasks than threads, the other ones stay idle
+    const unsigned int num_active = std::min<size_t>(num_threads_, num_tasks);
+    std::vector<TaskQueue> queues(num_active);
+    for (unsigned int t = 0; t < num_active; ++t) {
+        queues[t].front = num_tasks * t / num_active;
+        queues[t].back = num_tasks * (t + 1) / num_active;
+    }
+
+    std::atomic<bool> failed = false;
+    std::exception_ptr exception;
+    std::mutex exception_mutex;
+
+    // Pool threads work within the caller's context, so that their log messages go to the same place
+    api::Context* const context = globals::context;
+
+    pool->run([&](unsigned int thread_idx) {
+        if (thread_idx >= num_active)
+            return;
+        in_parallel_region = true;
+        api::Context* const prev_context = std::exchange(globals::context, context);
+        auto scope_guard = sg::make_scope_guard([prev_context]{
+            in_parallel_region = false;
+            globals::context = prev_context;
+        });
+        double thread_busy_time = 0;
+        while (!failed) {
+            size_t task;
+            if (!queues[thread_idx].pop_front(task)) {
+                // Own queue is drained, steal from the others starting at the next thread
+                bool stolen = false;
+                for (unsigned int k = 1; k < num_active && !stolen; ++k)
+                    stolen = queues[(thread_idx + k) % num_active].steal_back(task);
+                if (!stolen)
+                    break;
+            }
+            const auto start = clock::now();
+            try {
+                func(bounds[task], bounds[task + 1]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(exception_mutex);
+                if (!exception)
+                    exception = std::current_exception();
+                failed = true;
+            }
+            thread_busy_time += std::chrono::duration<double>(clock::now() - start).count();
+        }
+        std::lock_guard<std::mutex> lock(busy_time_mutex);
+        busy_time[thread_idx] += thread_busy_time;
+    });
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+}
+
+unsigned int parallel::num_threads() {
+    const unsigned int num_threads_ = globals::context ? globals::context->num_threads : globals::num_threads;
+    if (num_threads_ > 0)
+        return num_threads_;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void parallel::for_range(size_t n, const std::function<void(size_t, size_t)>& func) {
+    if (n == 0)
+        return;
+
+    const size_t chunk_size = std::max<size_t>(1, n / (tasks_per_thread * parallel::num_threads()));
+    std::vector<size_t> bounds;
+    for (size_t begin = 0; begin < n; begin += chunk_size)
+        bounds.push_back(begin);
+    bounds.push_back(n);
+
+    run_tasks(bounds, func);
+}
+
+void parallel::for_range(const std::vector<unsigned int>& cost_offsets, const std::function<void(size_t, size_t)>& func) {
+    const size_t n = cost_offsets.size() - 1;
+    if (n == 0)
+        return;
+
+    // Cut into tasks of roughly equal total cost; an item costlier than that gets a task of its own
+    const size_t target_cost = std::max<size_t>(1, (cost_offsets[n] - cost_offsets[0]) / (tasks_per_thread * parallel::num_threads()));
+    std::vector<size_t> bounds = { 0 };
+    for (size_t i = 1; i < n; ++i) {
+        if (cost_offsets[i] - cost_offsets[bounds.back()] >= target_cost)
+            bounds.push_back(i);
+    }
+    bounds.push_back(n);
+
+    run_tasks(bounds, func);
+}
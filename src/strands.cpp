@@ -0,0 +1,152 @@
+#include "strands.h"
+#include "parallel.h"
+
+Strands::Strands(const cyHairFile& hairfile, bool with_attributes) {
+    const auto& header = hairfile.GetHeader();
+    offsets = hairfile.GetOffsetsArray();
+
+    const unsigned int n = point_count();
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    if (with_attributes && hairfile.GetThicknessArray()) thickness.resize(n);
+    if (with_attributes && hairfile.GetTransparencyArray()) transparency.resize(n);
+    if (with_attributes && hairfile.GetColorsArray()) {
+        r.resize(n);
+        g.resize(n);
+        b.resize(n);
+    }
+    default_thickness = header.d_thickness;
+    default_transparency = header.d_transparency;
+    default_color = { header.d_color[0], header.d_color[1], header.d_color[2] };
+
+    parallel::for_range(n, [&](size_t begin, size_t end) {
+        const float* points = hairfile.GetPointsArray();
+        for (size_t k = begin; k < end; ++k) {
+            x[k] = points[3*k + 0];
+            y[k] = points[3*k + 1];
+            z[k] = points[3*k + 2];
+        }
+        if (!thickness.empty()) std::copy(hairfile.GetThicknessArray() + begin, hairfile.GetThicknessArray() + end, thickness.begin() + begin);
+        if (!transparency.empty()) std::copy(hairfile.GetTransparencyArray() + begin, hairfile.GetTransparencyArray() + end, transparency.begin() + begin);
+        if (!r.empty()) {
+            const float* colors = hairfile.GetColorsArray();
+            for (size_t k = begin; k < end; ++k) {
+                r[k] = colors[3*k + 0];
+                g[k] = colors[3*k + 1];
+                b[k] = colors[3*k + 2];
+            }
+        }
+    });
+}
+
+std::shared_ptr<cyHairFile> Strands::to_hairfile() const {
+    // The segments array is only needed if strands differ in length
+    bool uniform_nsegs = true;
+    for (unsigned int i = 1; i < hair_count() && uniform_nsegs; ++i)
+        uniform_nsegs = nsegs(i) == nsegs(0);
+
+    unsigned int max_nsegs = 0;
+    for (unsigned int i = 0; i < hair_count(); ++i)
+        max_nsegs = std::max(max_nsegs, nsegs(i));
+    if (max_nsegs > std::numeric_limits<unsigned short>::max()) {
+        throw std::runtime_error(fmt::format("Number of segments per strand {} exceeds the maximum limit: {}", max_nsegs, std::numeric_limits<unsigned short>::max()));
+    }
+
+    std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(hair_count());
+    hairfile->SetPointCount(point_count());
+    hairfile->SetArrays(
+        _CY_HAIR_FILE_POINTS_BIT |
+        (uniform_nsegs ? 0 : _CY_HAIR_FILE_SEGMENTS_BIT) |
+        (thickness.empty() ? 0 : _CY_HAIR_FILE_THICKNESS_BIT) |
+        (transparency.empty() ? 0 : _CY_HAIR_FILE_TRANSPARENCY_BIT) |
+        (r.empty() ? 0 : _CY_HAIR_FILE_COLORS_BIT)
+    );
+    hairfile->SetDefaultSegmentCount(uniform_nsegs && hair_count() > 0 ? nsegs(0) : 0);
+    hairfile->SetDefaultThickness(default_thickness);
+    hairfile->SetDefaultTransparency(default_transparency);
+    hairfile->SetDefaultColor(default_color[0], default_color[1], default_color[2]);
+
+    if (!uniform_nsegs) {
+        for (unsigned int i = 0; i < hair_count(); ++i)
+            hairfile->GetSegmentsArray()[i] = nsegs(i);
+    }
+    copy_points_to(*hairfile);
+    parallel::for_range(point_count(), [&](size_t begin, size_t end) {
+        if (!thickness.empty()) std::copy(thickness.begin() + begin, thickness.begin() + end, hairfile->GetThicknessArray() + begin);
+        if (!transparency.empty()) std::copy(transparency.begin() + begin, transparency.begin() + end, hairfile->GetTransparencyArray() + begin);
+        if (!r.empty()) {
+            float* colors = hairfile->GetColorsArray();
+            for (size_t k = begin; k < end; ++k) {
+                colors[3*k + 0] = r[k];
+                colors[3*k + 1] = g[k];
+                colors[3*k + 2] = b[k];
+            }
+        }
+    });
+    return hairfile;
+}
+
+void Strands::copy_points_to(cyHairFile& hairfile) const {
+    parallel::for_range(point_count(), [&](size_t begin, size_t end) {
+        float* points = hairfile.GetPointsArray();
+        for (size_t k = begin; k < end; ++k) {
+            points[3*k + 0] = x[k];
+            points[3*k + 1] = y[k];
+            points[3*k + 2] = z[k];
+        }
+    });
+}
+
+aligned_vector<float> Strands::segment_lengths() const {
+    aligned_vector<float> length(point_count());
+    parallel::for_range(offsets, [&](size_t begin, size_t end) {
+        // Run over the whole range of points at once, then clear the entries that span two strands
+        const size_t k_end = offsets[end];
+        for (size_t k = offsets[begin]; k + 1 < k_end; ++k) {
+            const float dx = x[k + 1] - x[k];
+            const float dy = y[k + 1] - y[k];
+            const float dz = z[k + 1] - z[k];
+            length[k] = std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+        for (size_t i = begin; i < end; ++i)
+            length[offsets[i + 1] - 1] = 0.0f;
+    });
+    return length;
+}
+
+Strands::Wedges Strands::wedges(const aligned_vector<float>& segment_lengths) const {
+    const unsigned int n = point_count();
+    Wedges res;
+    res.circumradius_reciprocal.resize(n);
+    res.turning_angle.resize(n);
+    res.curvature.resize(n);
+
+    parallel::for_range(offsets, [&](size_t begin, size_t end) {
+        // Run over the whole range of points at once, then clear the entries at strand ends
+        const size_t k_end = offsets[end];
+        for (size_t k = offsets[begin] + 1; k + 1 < k_end; ++k) {
+            const float la = segment_lengths[k - 1];
+            const float lb = segment_lengths[k];
+            const float dx = x[k + 1] - x[k - 1];
+            const float dy = y[k + 1] - y[k - 1];
+            const float dz = z[k + 1] - z[k - 1];
+            const float lc = std::sqrt(dx * dx + dy * dy + dz * dz);
+            const float s = (la + lb + lc) / 2.0f;
+            const float A = std::sqrt(s * (s - la) * (s - lb) * (s - lc));
+            const float turning_angle_rad = globals::pi - std::acos(std::clamp((la * la + lb * lb - lc * lc) / (2.0f * la * lb), -1.0f, 1.0f));
+            res.circumradius_reciprocal[k] = A > 0.0f ? 1.0f / (la * lb * lc / (4.0f * A)) : 0.0f;
+            res.turning_angle[k] = turning_angle_rad * 180.0f / globals::pi;
+            res.curvature[k] = turning_angle_rad / ((la + lb) / 2.0f);
+        }
+        for (size_t i = begin; i < end; ++i) {
+            for (const unsigned int k : { offsets[i], offsets[i + 1] - 1 }) {
+                res.circumradius_reciprocal[k] = 0.0f;
+                res.turning_angle[k] = 0.0f;
+                res.curvature[k] = 0.0f;
+            }
+        }
+    });
+    return res;
+}
@@ -0,0 +1,80 @@
+#include "subset.h"
+#include "parallel.h"
+
+HairSubset::HairSubset(std::shared_ptr<cyHairFile> base, std::vector<unsigned int> indices) : base(std::move(base)), indices(std::move(indices)) {
+    const std::vector<unsigned int>& base_offsets = this->base->GetOffsetsArray();
+    offsets.reserve(this->indices.size() + 1);
+    for (const unsigned int i : this->indices)
+        offsets.push_back(offsets.back() + base_offsets[i + 1] - base_offsets[i]);
+}
+
+HairSubset::HairSubset(std::shared_ptr<cyHairFile> base, const std::vector<unsigned char>& selected) : HairSubset(std::move(base), [&]{
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0; i < selected.size(); ++i) {
+        if (selected[i])
+            indices.push_back(i);
+    }
+    return indices;
+}()) {}
+
+HairSubset::HairSubset(std::shared_ptr<cyHairFile> base) : base(std::move(base)) {
+    indices.resize(this->base->GetHeader().hair_count);
+    std::iota(indices.begin(), indices.end(), 0);
+    offsets = this->base->GetOffsetsArray();
+}
+
+cyHairFile::Header HairSubset::header() const {
+    cyHairFile::Header header = base->GetHeader();
+    header.hair_count = hair_count();
+    header.point_count = point_count();
+    if (uniform_segments) {
+        header.arrays &= ~_CY_HAIR_FILE_SEGMENTS_BIT;
+        if (!empty())
+            header.d_segments = num_points(0) - 1;
+    }
+    return header;
+}
+
+std::shared_ptr<cyHairFile> HairSubset::materialize() const {
+    const cyHairFile::Header header_out = header();
+
+    // Create output hair file
+    std::shared_ptr<cyHairFile> hairfile_out = std::make_shared<cyHairFile>();
+
+    // Copy header via memcpy
+    std::memcpy((void*)&hairfile_out->GetHeader(), &header_out, sizeof(cyHairFile::Header));
+
+    // Set hair_count & point_count, allocate arrays
+    hairfile_out->SetHairCount(hair_count());
+    hairfile_out->SetPointCount(point_count());
+    hairfile_out->SetArrays(header_out.arrays);
+
+    log_debug("Input-output index mapping (strand idx ; root vertex idx):");
+    for (unsigned int k = 0; k < hair_count(); ++k)
+        log_debug("  {} -> {} ; {} -> {}", indices[k], k, base_offset(k), offsets[k]);
+
+    // Copy array data, the selected strands being independent of each other
+    const auto copy = [](const float* in, float* out, size_t in_offset, size_t out_offset, size_t count) {
+        if (in)
+            std::copy(in + in_offset, in + in_offset + count, out + out_offset);
+    };
+    parallel::for_range(offsets, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k)
+        {
+            const unsigned int in_point_offset = base_offset(k);
+            const unsigned int out_point_offset = offsets[k];
+
+            // Copy segment info if available
+            if (header_out.arrays & _CY_HAIR_FILE_SEGMENTS_BIT)
+                hairfile_out->GetSegmentsArray()[k] = num_points(k) - 1;
+
+            // Copy per-point info if available
+            copy(base->GetPointsArray(), hairfile_out->GetPointsArray(), 3 * in_point_offset, 3 * out_point_offset, 3 * num_points(k));
+            copy(base->GetThicknessArray(), hairfile_out->GetThicknessArray(), in_point_offset, out_point_offset, num_points(k));
+            copy(base->GetTransparencyArray(), hairfile_out->GetTransparencyArray(), in_point_offset, out_point_offset, num_points(k));
+            copy(base->GetColorsArray(), hairfile_out->GetColorsArray(), 3 * in_point_offset, 3 * out_point_offset, 3 * num_points(k));
+        }
+    });
+
+    return hairfile_out;
+}
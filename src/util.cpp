@@ -1,80 +1,113 @@
 #include "util.h"
+#include "io.h"
 
-std::shared_ptr<cyHairFile> util::get_subset(std::shared_ptr<cyHairFile> hairfile_in, const std::vector<unsigned char>& selected) {
-    const auto& header_in = hairfile_in->GetHeader();
-
-    const unsigned int num_selected = std::accumulate(selected.begin(), selected.end(), 0);
-
-    if (num_selected == 0) {
-        log_warn("No strand is selected");
-        return {};
-    }
-    log_info("Selected {} strands", num_selected);
-
-    // Count the number of selected strands and their points
-    unsigned int out_hair_count = num_selected;
-    unsigned int out_point_count = 0;
-    for (int i = 0; i < header_in.hair_count; ++i)
-    {
-        if (selected[i])
-            out_point_count += (hairfile_in->GetSegmentsArray() ? hairfile_in->GetSegmentsArray()[i] : header_in.d_segments) + 1;
+bool util::match_wildcard(const std::string& str, const std::string& pattern) {
+    // Greedy matching, backtracking to the last '*'
+    size_t s = 0, p = 0;
+    size_t star_p = std::string::npos, star_s = 0;
+    while (s < str.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+            ++s;
+            ++p;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star_p = p++;
+            star_s = s;
+        } else if (star_p != std::string::npos) {
+            p = star_p + 1;
+            s = ++star_s;
+        } else {
+            return false;
+        }
     }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
 
-    // Create output hair file
-    std::shared_ptr<cyHairFile> hairfile_out = std::make_shared<cyHairFile>();
-
-    // Copy header via memcpy
-    std::memcpy((void*)&hairfile_out->GetHeader(), &header_in, sizeof(cyHairFile::Header));
-
-    // Set hair_count & point_count, allocate arrays
-    hairfile_out->SetHairCount(out_hair_count);
-    hairfile_out->SetPointCount(out_point_count);
-    hairfile_out->SetArrays(header_in.arrays);
-
-    // Copy array data
-    unsigned int in_point_offset = 0;
-    unsigned int out_hair_idx = 0;
-    unsigned int out_point_offset = 0;
-    log_debug("Input-output index mapping (strand idx ; root vertex idx):");
-    for (unsigned int in_hair_idx = 0; in_hair_idx < header_in.hair_count; ++in_hair_idx)
-    {
-        const unsigned int nsegs = hairfile_in->GetSegmentsArray() ? hairfile_in->GetSegmentsArray()[in_hair_idx] : header_in.d_segments;
+bool util::is_batch_input(const std::string& input_file) {
+    if (input_file.find_first_of("*?") != std::string::npos)
+        return true;
+    std::string ext = std::filesystem::path(input_file).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c){ return std::tolower(c); });
+    return ext == ".txt";
+}
 
-        if (selected[in_hair_idx])
-        {
-            log_debug("  {} -> {} ; {} -> {}", in_hair_idx, out_hair_idx, in_point_offset, out_point_offset);
+std::vector<std::string> util::list_batch_input_files(const std::string& input_file) {
+    const std::filesystem::path path(input_file);
+    std::vector<std::string> input_files;
 
-            // Copy segment info if available
-            if (header_in.arrays & _CY_HAIR_FILE_SEGMENTS_BIT)
-                hairfile_out->GetSegmentsArray()[out_hair_idx++] = nsegs;
+    if (input_file.find_first_of("*?") == std::string::npos) {
+        // List file
+        std::ifstream ifs(input_file);
+        if (!ifs)
+            throw std::runtime_error(fmt::format("Failed to open list file: {}", input_file));
+        std::string line;
+        while (std::getline(ifs, line)) {
+            line = trim_whitespaces(line);
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::filesystem::path file(line);
+            if (file.is_relative())
+                file = path.parent_path() / file;
+            input_files.push_back(file.string());
+        }
+    } else {
+        // Wildcard pattern in the file name
+        const std::filesystem::path dir = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        if (dir.string().find_first_of("*?") != std::string::npos)
+            throw std::runtime_error(fmt::format("Wildcards are only supported in the file name: {}", input_file));
+        if (!std::filesystem::is_directory(dir))
+            throw std::runtime_error(fmt::format("Directory not found: {}", dir.string()));
+        const std::string pattern = path.filename().string();
+        for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+            if (entry.is_regular_file() && match_wildcard(entry.path().filename().string(), pattern))
+                input_files.push_back((path.has_parent_path() ? entry.path() : entry.path().filename()).string());
+        }
+        std::sort(input_files.begin(), input_files.end());
 
-            // Copy per-point info if available
-            for (int j = 0; j < nsegs + 1; ++j)
-            {
-                if (header_in.arrays & _CY_HAIR_FILE_POINTS_BIT)
-                {
-                    for (int k = 0; k < 3; ++k)
-                        hairfile_out->GetPointsArray()[3*(out_point_offset + j) + k] = hairfile_in->GetPointsArray()[3*(in_point_offset + j) + k];
-                }
+        // Strand offsets going with a matched .npy file are not hair files of their own
+        std::set<std::string> offsets_files;
+        for (const std::string& file : input_files) {
+            if (std::filesystem::path(file).extension() == ".npy")
+                offsets_files.insert(io::npy_offsets_filename(file));
+        }
+        std::erase_if(input_files, [&](const std::string& file) { return offsets_files.count(file) > 0; });
+    }
 
-                if (header_in.arrays & _CY_HAIR_FILE_THICKNESS_BIT)
-                    hairfile_out->GetThicknessArray()[out_point_offset + j] = hairfile_in->GetThicknessArray()[in_point_offset + j];
+    if (input_files.empty())
+        throw std::runtime_error(fmt::format("No input files found for {}", input_file));
+    return input_files;
+}
 
-                if (header_in.arrays & _CY_HAIR_FILE_TRANSPARENCY_BIT)
-                    hairfile_out->GetTransparencyArray()[out_point_offset + j] = hairfile_in->GetTransparencyArray()[in_point_offset + j];
+std::vector<std::pair<unsigned int, unsigned int>> util::parse_strand_ranges(const std::string& str) {
+    const auto parse_index = [&](const std::string& index_str) -> unsigned int {
+        const std::string trimmed = trim_whitespaces(index_str);
+        if (trimmed.empty() || trimmed.find_first_not_of("0123456789") != std::string::npos || trimmed.size() > 9)
+            throw std::runtime_error(fmt::format("Invalid strand index '{}' in '{}'", index_str, str));
+        return std::stoul(trimmed);
+    };
 
-                if (header_in.arrays & _CY_HAIR_FILE_COLORS_BIT)
-                {
-                    for (int k = 0; k < 3; ++k)
-                        hairfile_out->GetColorsArray()[3*(out_point_offset + j) + k] = hairfile_in->GetColorsArray()[3*(in_point_offset + j) + k];
-                }
-            }
-            out_point_offset += nsegs + 1;
-        }
-        in_point_offset += nsegs + 1;
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+    for (size_t start = 0; start <= str.size(); ) {
+        const size_t end = std::min(str.find(',', start), str.size());
+        const std::string item = str.substr(start, end - start);
+        const size_t dash = item.find('-');
+        const unsigned int first = parse_index(item.substr(0, dash));
+        const unsigned int last = dash == std::string::npos ? first : parse_index(item.substr(dash + 1));
+        if (last < first)
+            throw std::runtime_error(fmt::format("Invalid strand range '{}' in '{}'", item, str));
+        ranges.push_back({ first, last + 1 });
+        start = end + 1;
     }
-    if (header_in.arrays & _CY_HAIR_FILE_SEGMENTS_BIT)
-        assert(out_hair_idx == out_hair_count);
 
-    return hairfile_out;
+    // Sort and merge overlapping or adjacent ranges
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<unsigned int, unsigned int>> merged;
+    for (const auto& range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    return merged;
 }
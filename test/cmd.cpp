@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 
+#include "api.h"
 #include "io.h"
 
+#include <thread>
+
 extern int test_main(int argc, const char **argv);
 
 using namespace Eigen;
@@ -106,6 +109,20 @@ TEST(cmd_convert, bin_to_data_ply) {
     EXPECT_EQ(test_main(args.size(), args.data()), 0);
 }
 
+TEST(cmd_convert, batch_glob) {
+    std::vector<const char*> args = {
+        "test_cmd",
+        "convert",
+        "-i", TEST_DATA_DIR "/Bangs_*.bin",
+        "-o", "data",
+        "-d", TEST_DATA_DIR "/out",
+        "--overwrite",
+        "--threads", "2"
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 0);
+}
+
 TEST(cmd_convert, bin_to_data_ply_bin) {
     std::vector<const char*> args = {
         "test_cmd",
@@ -119,6 +136,35 @@ TEST(cmd_convert, bin_to_data_ply_bin) {
     EXPECT_EQ(test_main(args.size(), args.data()), 1);
 }
 
+TEST(cmd_convert, fail_ply_profile) {
+    std::vector<const char*> args = {
+        "test_cmd",
+        "convert",
+        "-i", TEST_DATA_DIR "/Bangs_100.bin",
+        "-o", "ply",
+        "-d", TEST_DATA_DIR "/out",
+        "--overwrite",
+        "--ply-profile", "minmal"
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 1);
+}
+
+TEST(cmd_convert, fail_npy_offsets_exists) {
+    std::filesystem::create_directories(TEST_DATA_DIR "/out_npy_offsets");
+    std::filesystem::remove(TEST_DATA_DIR "/out_npy_offsets/Bangs_100.npy");
+    std::ofstream(TEST_DATA_DIR "/out_npy_offsets/Bangs_100_offsets.npy");
+    std::vector<const char*> args = {
+        "test_cmd",
+        "convert",
+        "-i", TEST_DATA_DIR "/Bangs_100.bin",
+        "-o", "npy",
+        "-d", TEST_DATA_DIR "/out_npy_offsets"
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 1);
+}
+
 TEST(cmd_decompose, bin_to_ply_data) {
     std::vector<const char*> args = {
         "test_cmd",
@@ -261,6 +307,36 @@ TEST(cmd_info, print_json) {
     EXPECT_EQ(test_main(args.size(), args.data()), 0);
 }
 
+TEST(cmd_pipe, transform_resample_smooth) {
+    std::vector<const char*> args = {
+        "test_cmd",
+        "pipe",
+        "-i", TEST_DATA_DIR "/Bangs_100.bin",
+        "--overwrite",
+        "--",
+        "transform", "-s", "0.01", ":",
+        "resample", "-l", "0.02", ":",
+        "smooth", "-o", "ply,data",
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 0);
+}
+
+TEST(cmd_pipe, fail_empty_stage) {
+    std::vector<const char*> args = {
+        "test_cmd",
+        "pipe",
+        "-i", TEST_DATA_DIR "/Bangs_100.bin",
+        "-o", "ply",
+        "--overwrite",
+        "--",
+        "transform", "-s", "0.01", ":", ":",
+        "smooth",
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 1);
+}
+
 TEST(cmd_resample, bin_to_ply) {
     std::vector<const char*> args = {
         "test_cmd",
@@ -274,6 +350,20 @@ TEST(cmd_resample, bin_to_ply) {
     EXPECT_EQ(test_main(args.size(), args.data()), 0);
 }
 
+TEST(cmd_resample, threads) {
+    std::vector<const char*> args = {
+        "test_cmd",
+        "resample",
+        "-i", TEST_DATA_DIR "/Bangs_100.bin",
+        "-o", "ply",
+        "--target-segment-length", "2.0",
+        "--overwrite",
+        "--threads", "4",
+    };
+    globals::clear();
+    EXPECT_EQ(test_main(args.size(), args.data()), 0);
+}
+
 TEST(cmd_resample, tsl_0) {
     std::vector<const char*> args = {
         "test_cmd",
@@ -606,6 +696,67 @@ TEST(cmd_tubify, Bangs_100) {
     EXPECT_EQ(test_main(args.size(), args.data()), 0);
 }
 
+TEST(api_filter, concurrent_calls) {
+    globals::clear();
+    const auto hairfile = io::load_bin(TEST_DATA_DIR "/Bangs_100.bin");
+    const api::FilterOptions options = { .key = "length", .gt = 10.0f };
+
+    const std::vector<double> busy_time = globals::thread_busy_time;
+
+    api::Context ctx_ref;
+    ctx_ref.num_threads = 1;
+    const api::FilterResult result_ref = api::filter(ctx_ref, hairfile, options);
+    ASSERT_FALSE(result_ref.indices.empty());
+
+    // Calls with their own contexts must neither interfere with each other nor touch globals
+    std::vector<api::Context> contexts(4);
+    std::vector<api::FilterResult> results(contexts.size());
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < contexts.size(); ++k) {
+        threads.emplace_back([&, k]{
+            contexts[k].num_threads = 2;
+            results[k] = api::filter(contexts[k], hairfile, options);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (size_t k = 0; k < contexts.size(); ++k) {
+        EXPECT_EQ(results[k].indices, result_ref.indices);
+        EXPECT_EQ(results[k].subset.indices, result_ref.indices);
+        EXPECT_EQ(contexts[k].log, ctx_ref.log);
+        EXPECT_FALSE(contexts[k].thread_busy_time.empty());
+    }
+    EXPECT_FALSE(globals::json.contains("log"));
+    EXPECT_EQ(globals::thread_busy_time, busy_time);
+}
+
+TEST(api_filter, invalid_key) {
+    const auto hairfile = io::load_bin(TEST_DATA_DIR "/Bangs_100.bin");
+    api::Context ctx;
+    EXPECT_THROW(api::filter(ctx, hairfile, { .key = "foo", .lt = 1.0f }), std::runtime_error);
+}
+
+TEST(api_autofix, in_place) {
+    // Strand 2 has no segments; duplicate the second point of strand 3
+    auto hairfile = generate_test_data();
+    float* points = hairfile->GetPointsArray();
+    const unsigned int dup_idx = hairfile->GetOffsetsArray()[3] + 2;
+    std::copy_n(points + 3 * (dup_idx - 1), 3, points + 3 * dup_idx);
+
+    api::Context ctx;
+    ASSERT_TRUE(api::autofix(ctx, hairfile));
+    EXPECT_EQ(hairfile->GetHeader().hair_count, 4);
+    EXPECT_EQ(hairfile->GetOffsetsArray(), std::vector<unsigned int>({ 0, 4, 9, 15, 23 }));
+    EXPECT_EQ(hairfile->GetPointsArray()[3 * 9], 3.0f);
+    EXPECT_EQ(hairfile->GetPointsArray()[3 * 11 + 1], 3.0f);
+    EXPECT_EQ(hairfile->GetThicknessArray()[15], 0.5f);
+
+    // Clean now
+    EXPECT_FALSE(api::autofix(ctx, hairfile));
+    EXPECT_EQ(hairfile->GetHeader().point_count, 23);
+}
+
 int main(int argc, char **argv) {
     spdlog::set_level(spdlog::level::trace);
     testing::InitGoogleTest(&argc, argv);
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 
 #include "io.h"
+#include "mapped_file.h"
+
+#include <Alembic/AbcCoreOgawa/All.h>
+#include <Alembic/AbcGeom/All.h>
+
+#include <fstream>
 
 namespace {
 
@@ -62,6 +68,17 @@ std::shared_ptr<cyHairFile> generate_test_data(bool uniform_segments = false) {
     return hairfile;
 }
 
+void write_abc_curves(const Alembic::Abc::OObject& parent, const std::string& name, const std::vector<Alembic::Abc::V3f>& positions, const std::vector<std::int32_t>& nVertices) {
+    Alembic::AbcGeom::OCurves curves(parent, name);
+    Alembic::AbcGeom::OCurvesSchema::Sample sample;
+    sample.setPositions(positions);
+    sample.setCurvesNumVertices(nVertices);
+    sample.setType(Alembic::AbcGeom::kLinear);
+    sample.setWrap(Alembic::AbcGeom::kNonPeriodic);
+    sample.setBasis(Alembic::AbcGeom::kNoBasis);
+    curves.getSchema().set(sample);
+}
+
 }
 
 TEST(io_abc, read) { auto hairfile = io::load_abc(TEST_DATA_DIR "/Bangs_100.abc"); }
@@ -81,7 +98,345 @@ TEST(io_ma, write) { auto hairfile = generate_test_data(); io::save_ma("test_io_
 TEST(io_ply, write_ascii) { auto hairfile = generate_test_data(); globals::ply_save_ascii = true; io::save_ply("test_io_out_ascii.ply", hairfile); }
 TEST(io_ply, write_binary) { auto hairfile = generate_test_data(); globals::ply_save_ascii = false; io::save_ply("test_io_out_binary.ply", hairfile); }
 TEST(io_npy, write) { auto hairfile = generate_test_data(true); io::save_npy("test_io_out_binary.npy", hairfile); }
-TEST(io_npy, write_fail) { auto hairfile = generate_test_data(false); EXPECT_THROW({ io::save_npy("test_io_out_binary.npy", hairfile); }, std::runtime_error); }
+TEST(io_npy, write_ragged) {
+    auto hairfile = generate_test_data(false);
+    io::save_npy("test_io_out_ragged.npy", hairfile);
+    EXPECT_TRUE(std::filesystem::exists("test_io_out_ragged_offsets.npy"));
+    auto hairfile_in = io::load_npy("test_io_out_ragged.npy");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * hairfile->GetHeader().point_count, hairfile_in->GetPointsArray()));
+
+    // Overwritten by strands with the same number of segments, without offsets
+    io::save_npy("test_io_out_ragged.npy", generate_test_data(true));
+    EXPECT_FALSE(std::filesystem::exists("test_io_out_ragged_offsets.npy"));
+}
+
+TEST(io_abc, read_transforms) {
+    using namespace Alembic;
+    {
+        // outer (translation) / inner (scale) / curves_a, then outer / curves_b
+        Abc::OArchive archive(AbcCoreOgawa::WriteArchive(), "test_io_out_transforms.abc");
+        AbcGeom::OXform outer(archive.getTop(), "outer");
+        AbcGeom::XformSample outer_sample;
+        outer_sample.setTranslation(Abc::V3d(1.0, 2.0, 3.0));
+        outer.getSchema().set(outer_sample);
+        AbcGeom::OXform inner(outer, "inner");
+        AbcGeom::XformSample inner_sample;
+        inner_sample.setScale(Abc::V3d(2.0, 3.0, 4.0));
+        inner.getSchema().set(inner_sample);
+        write_abc_curves(inner, "curves_a", {{ 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }}, { 3 });
+        write_abc_curves(outer, "curves_b", {{ 1, 1, 1 }, { 2, 2, 2 }}, { 2 });
+    }
+    auto hairfile = io::load_abc("test_io_out_transforms.abc");
+    EXPECT_EQ(hairfile->GetOffsetsArray(), std::vector<unsigned int>({ 0, 3, 5 }));
+    // Scaled then translated for curves_a, translated only for curves_b
+    const std::vector<float> expected = { 3, 2, 3,  1, 5, 3,  1, 2, 7,  2, 3, 4,  3, 4, 5 };
+    for (size_t k = 0; k < expected.size(); ++k)
+        EXPECT_NEAR(hairfile->GetPointsArray()[k], expected[k], 1e-5f);
+}
+TEST(io_abc, read_bad_num_vertices) {
+    {
+        Alembic::Abc::OArchive archive(Alembic::AbcCoreOgawa::WriteArchive(), "test_io_out_bad_num_vertices.abc");
+        write_abc_curves(archive.getTop(), "curves", {{ 0, 0, 0 }, { 1, 0, 0 }}, { 3 });
+    }
+    EXPECT_THROW({ io::load_abc("test_io_out_bad_num_vertices.abc"); }, std::runtime_error);
+}
+
+TEST(io_bin, read_truncated) { io::save_bin("test_io_out_truncated.bin", generate_test_data()); std::filesystem::resize_file("test_io_out_truncated.bin", 100); EXPECT_THROW({ io::load_bin("test_io_out_truncated.bin"); }, std::runtime_error); }
+TEST(io_data, read_truncated) { io::save_data("test_io_out_truncated.data", generate_test_data()); std::filesystem::resize_file("test_io_out_truncated.data", 100); EXPECT_THROW({ io::load_data("test_io_out_truncated.data"); }, std::runtime_error); }
+
+TEST(io_data, read_too_many_points) {
+    // Sparse file of 65538 strands of 65536 points, more points in total than unsigned int can count
+    const int hair_count = 65538, num_points = 65536;
+    {
+        std::ofstream file("test_io_out_too_many_points.data", std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&hair_count), sizeof(int));
+        for (int i = 0; i < hair_count; ++i) {
+            file.seekp(sizeof(int) + (sizeof(int) + 3 * sizeof(float) * num_points) * size_t(i));
+            file.write(reinterpret_cast<const char*>(&num_points), sizeof(int));
+        }
+    }
+    std::filesystem::resize_file("test_io_out_too_many_points.data", sizeof(int) + (sizeof(int) + 3 * sizeof(float) * num_points) * size_t(hair_count));
+    EXPECT_THROW({ io::load_data("test_io_out_too_many_points.data"); }, std::runtime_error);
+    std::filesystem::remove("test_io_out_too_many_points.data");
+}
+
+TEST(io_mapped_output_file, commit) {
+    std::ofstream("test_io_out_mapped.bin") << "old";
+    {
+        // Destroyed without commit(), leaving the previous file as it was
+        MappedOutputFile file("test_io_out_mapped.bin", 4);
+        std::memcpy(file.data(), "new!", 4);
+    }
+    EXPECT_EQ(std::filesystem::file_size("test_io_out_mapped.bin"), 3);
+    EXPECT_FALSE(std::filesystem::exists("test_io_out_mapped.bin.tmp"));
+    {
+        MappedOutputFile file("test_io_out_mapped.bin", 4);
+        std::memcpy(file.data(), "new!", 4);
+        file.commit();
+    }
+    EXPECT_EQ(std::filesystem::file_size("test_io_out_mapped.bin"), 4);
+    EXPECT_FALSE(std::filesystem::exists("test_io_out_mapped.bin.tmp"));
+}
+
+TEST(io_bin, round_trip) {
+    auto hairfile = generate_test_data();
+    io::save_bin("test_io_out_round_trip.bin", hairfile);
+    auto hairfile_in = io::load_bin("test_io_out_round_trip.bin");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * hairfile->GetHeader().point_count, hairfile_in->GetPointsArray()));
+}
+
+TEST(io_data, round_trip) {
+    auto hairfile = generate_test_data();
+    io::save_data("test_io_out_round_trip.data", hairfile);
+    auto hairfile_in = io::load_data("test_io_out_round_trip.data");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * hairfile->GetHeader().point_count, hairfile_in->GetPointsArray()));
+}
+
+TEST(io_ma, read_extra_attributes) {
+    // Attributes other than ".cc", CVs sharing lines, and a curve without ".cc" to skip
+    std::ofstream("test_io_out_extra.ma") << R"(requires maya "2014";
+createNode transform -n "group1";
+createNode nurbsCurve -n "curveShape1" -p "curve1";
+	setAttr -k off ".v";
+	setAttr ".ove" yes;
+	setAttr ".cc" -type "nurbsCurve"
+		1 2 0 no 3
+		3 0 1 2
+		3
+		0 0 0 1 0 0
+		2 0.5 -1e-2
+		;
+createNode nurbsCurve -n "curveShape2" -p "curve2";
+	setAttr -k off ".v";
+createNode nurbsCurve -n "curveShape3" -p "curve3";
+	setAttr ".cc" -type "nurbsCurve" 1 1 0 no 3 2 0 1 2 4 5 6 7 8 9 ;
+)";
+    auto hairfile = io::load_ma("test_io_out_extra.ma");
+    EXPECT_EQ(hairfile->GetHeader().hair_count, 2);
+    EXPECT_EQ(hairfile->GetOffsetsArray(), std::vector<unsigned int>({ 0, 3, 5 }));
+    EXPECT_EQ(hairfile->GetPointsArray()[8], -0.01f);
+    EXPECT_EQ(hairfile->GetPointsArray()[14], 9.0f);
+}
+
+TEST(io_ma, round_trip) {
+    auto hairfile = generate_test_data();
+    io::save_ma("test_io_out_round_trip.ma", hairfile);
+    auto hairfile_in = io::load_ma("test_io_out_round_trip.ma");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * hairfile->GetHeader().point_count, hairfile_in->GetPointsArray()));
+}
+
+TEST(io_ply, round_trip) {
+    auto hairfile = generate_test_data();
+    for (const bool ascii : { false, true }) {
+        globals::ply_save_ascii = ascii;
+        io::save_ply("test_io_out_round_trip.ply", hairfile);
+        auto hairfile_in = io::load_ply("test_io_out_round_trip.ply");
+        EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+        const unsigned int point_count = hairfile->GetHeader().point_count;
+        EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * point_count, hairfile_in->GetPointsArray()));
+        EXPECT_TRUE(std::equal(hairfile->GetThicknessArray(), hairfile->GetThicknessArray() + point_count, hairfile_in->GetThicknessArray()));
+        ASSERT_NE(hairfile_in->GetColorsArray(), nullptr);
+        ASSERT_NE(hairfile_in->GetTransparencyArray(), nullptr);
+    }
+}
+
+TEST(io_ply, write_minimal) {
+    auto hairfile = generate_test_data();
+    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
+    globals::ply_save_ascii = false;
+    globals::ply_save_minimal = true;
+    io::save_ply("test_io_out_minimal.ply", hairfile);
+    globals::ply_save_minimal = false;
+    auto hairfile_in = io::load_ply("test_io_out_minimal.ply");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    EXPECT_EQ(hairfile_in->GetColorsArray(), nullptr);
+    // Header, then only the points and segment counts
+    EXPECT_LT(std::filesystem::file_size("test_io_out_minimal.ply"), 200 + 12 * hairfile->GetHeader().point_count + 2 * hairfile->GetHeader().hair_count);
+}
+
+TEST(io_hair, read_mapped) {
+    // 100 strands, so that the arrays following the segments array are aligned and used in place
+    auto hairfile = io::load_hair(TEST_DATA_DIR "/Bangs_100.hair");
+    EXPECT_TRUE(hairfile->HasExternalArrays());
+    auto hairfile_bin = io::load_bin(TEST_DATA_DIR "/Bangs_100.bin");
+    EXPECT_EQ(hairfile->GetOffsetsArray(), hairfile_bin->GetOffsetsArray());
+    const float x = hairfile->GetPointsArray()[0];
+    EXPECT_EQ(x, hairfile_bin->GetPointsArray()[0]);
+
+    // Writes do not reach the file, and arrays are copied before changing sizes
+    hairfile->GetPointsArray()[0] = x + 1.0f;
+    EXPECT_EQ(io::load_hair(TEST_DATA_DIR "/Bangs_100.hair")->GetPointsArray()[0], x);
+    hairfile->SetArrays(hairfile->GetHeader().arrays | _CY_HAIR_FILE_THICKNESS_BIT);
+    EXPECT_FALSE(hairfile->HasExternalArrays());
+    EXPECT_EQ(hairfile->GetPointsArray()[0], x + 1.0f);
+}
+TEST(io_hair, round_trip) {
+    auto hairfile = generate_test_data();
+    io::save_hair("test_io_out_round_trip.hair", hairfile);
+    auto hairfile_in = io::load_hair("test_io_out_round_trip.hair");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    const unsigned int point_count = hairfile->GetHeader().point_count;
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * point_count, hairfile_in->GetPointsArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetThicknessArray(), hairfile->GetThicknessArray() + point_count, hairfile_in->GetThicknessArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetTransparencyArray(), hairfile->GetTransparencyArray() + point_count, hairfile_in->GetTransparencyArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetColorsArray(), hairfile->GetColorsArray() + 3 * point_count, hairfile_in->GetColorsArray()));
+    EXPECT_EQ(hairfile_in->GetHeader().d_color[2], 0.75f);
+}
+TEST(io_hair, write_fail) { EXPECT_THROW({ io::save_hair("nonexistent_dir/test_io_out.hair", generate_test_data()); }, std::runtime_error); }
+TEST(io_hair, read_truncated) { io::save_hair("test_io_out_truncated.hair", generate_test_data()); std::filesystem::resize_file("test_io_out_truncated.hair", 200); EXPECT_THROW({ io::load_hair("test_io_out_truncated.hair"); }, std::runtime_error); }
+
+TEST(io_hzc, round_trip) {
+    auto hairfile = generate_test_data();
+    const unsigned int point_count = hairfile->GetHeader().point_count;
+    for (const float error : { 1e-3f, 0.0f }) {
+        for (const unsigned int deflate_level : { 0u, 6u }) {
+            globals::hzc_error = error;
+            globals::hzc_deflate_level = deflate_level;
+            io::save_hzc("test_io_out_round_trip.hzc", hairfile);
+            auto hairfile_in = io::load_hzc("test_io_out_round_trip.hzc");
+            EXPECT_EQ(hairfile_in->GetHeader().arrays, hairfile->GetHeader().arrays);
+            EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+            const auto near = [&](float a, float b) { return std::abs(a - b) <= error * 1.0001f; };
+            EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * point_count, hairfile_in->GetPointsArray(), near));
+            EXPECT_TRUE(std::equal(hairfile->GetThicknessArray(), hairfile->GetThicknessArray() + point_count, hairfile_in->GetThicknessArray(), near));
+            EXPECT_TRUE(std::equal(hairfile->GetTransparencyArray(), hairfile->GetTransparencyArray() + point_count, hairfile_in->GetTransparencyArray(), near));
+            EXPECT_TRUE(std::equal(hairfile->GetColorsArray(), hairfile->GetColorsArray() + 3 * point_count, hairfile_in->GetColorsArray(), near));
+            EXPECT_EQ(hairfile_in->GetHeader().d_color[2], 0.75f);
+        }
+    }
+    globals::clear();
+}
+
+TEST(io_hzc, lossless_bits) {
+    auto hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(1);
+    hairfile->SetPointCount(3);
+    hairfile->SetArrays(_CY_HAIR_FILE_POINTS_BIT);
+    hairfile->SetDefaultSegmentCount(2);
+    const std::vector<float> values = { -0.0f, 0.0f, -1.5f, 1e-40f, -1e-40f, -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), std::nanf("7") };
+    std::copy(values.begin(), values.end(), hairfile->GetPointsArray());
+    globals::hzc_error = 0.0f;
+    io::save_hzc("test_io_out_lossless.hzc", hairfile);
+    auto hairfile_in = io::load_hzc("test_io_out_lossless.hzc");
+    EXPECT_EQ(std::memcmp(hairfile_in->GetPointsArray(), hairfile->GetPointsArray(), sizeof(float) * values.size()), 0);
+    globals::clear();
+}
+
+TEST(io_hzc, read_bad_raw_size) {
+    globals::hzc_deflate_level = 6;
+    io::save_hzc("test_io_out_bad_raw_size.hzc", generate_test_data());
+    globals::clear();
+    {
+        // raw_size of the first chunk, after the 64-byte header
+        std::fstream file("test_io_out_bad_raw_size.hzc", std::ios::in | std::ios::out | std::ios::binary);
+        const uint64_t raw_size = uint64_t(1) << 62;
+        file.seekp(64 + 24);
+        file.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+    }
+    EXPECT_THROW({ io::load_hzc("test_io_out_bad_raw_size.hzc"); }, std::runtime_error);
+}
+
+TEST(io_hzc, read_range) {
+    // Enough points for several chunks
+    auto hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(3000);
+    hairfile->SetPointCount(3000 * 50);
+    hairfile->SetArrays(_CY_HAIR_FILE_POINTS_BIT);
+    hairfile->SetDefaultSegmentCount(49);
+    for (unsigned int k = 0; k < 3 * 3000 * 50; ++k)
+        hairfile->GetPointsArray()[k] = std::sin(0.01f * k);
+    io::save_hzc("test_io_out_range.hzc", hairfile);
+    const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+    for (const auto [begin, end] : { std::pair{ 0u, 3000u }, std::pair{ 1000u, 2900u }, std::pair{ 2999u, 3000u }, std::pair{ 5u, 5u } }) {
+        auto hairfile_in = io::load_hzc_subset("test_io_out_range.hzc", {{ begin, end }});
+        EXPECT_EQ(hairfile_in->GetHeader().hair_count, end - begin);
+        EXPECT_EQ(hairfile_in->GetHeader().point_count, offsets[end] - offsets[begin]);
+        EXPECT_TRUE(std::equal(hairfile->GetPointsArray() + 3 * offsets[begin], hairfile->GetPointsArray() + 3 * offsets[end], hairfile_in->GetPointsArray(),
+                               [](float a, float b) { return std::abs(a - b) <= 1.001e-4f; }));
+    }
+    // Ranges in a single chunk and across chunks, in the order given
+    auto hairfile_in = io::load_hzc_subset("test_io_out_range.hzc", {{ 2500, 2510 }, { 10, 1500 }});
+    EXPECT_EQ(hairfile_in->GetHeader().hair_count, 1500);
+    EXPECT_NEAR(hairfile_in->GetPointsArray()[0], hairfile->GetPointsArray()[3 * offsets[2500]], 1.001e-4f);
+    EXPECT_NEAR(hairfile_in->GetPointsArray()[3 * 500], hairfile->GetPointsArray()[3 * offsets[10]], 1.001e-4f);
+    EXPECT_THROW({ io::load_hzc_subset("test_io_out_range.hzc", {{ 50, 3001 }}); }, std::runtime_error);
+}
+
+TEST(io_h5, round_trip) {
+    auto hairfile = generate_test_data();
+    io::save_h5("test_io_out_round_trip.h5", hairfile);
+    auto hairfile_in = io::load_h5("test_io_out_round_trip.h5");
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), hairfile->GetOffsetsArray());
+    const unsigned int point_count = hairfile->GetHeader().point_count;
+    EXPECT_TRUE(std::equal(hairfile->GetPointsArray(), hairfile->GetPointsArray() + 3 * point_count, hairfile_in->GetPointsArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetThicknessArray(), hairfile->GetThicknessArray() + point_count, hairfile_in->GetThicknessArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetTransparencyArray(), hairfile->GetTransparencyArray() + point_count, hairfile_in->GetTransparencyArray()));
+    EXPECT_TRUE(std::equal(hairfile->GetColorsArray(), hairfile->GetColorsArray() + 3 * point_count, hairfile_in->GetColorsArray()));
+    EXPECT_EQ(hairfile_in->GetHeader().d_color[2], 0.75f);
+}
+
+TEST(io_h5, read_range) {
+    auto hairfile = generate_test_data();
+    io::save_h5("test_io_out_range.h5", hairfile);
+    auto hairfile_in = io::load_h5_subset("test_io_out_range.h5", {{ 1, 3 }});
+    EXPECT_EQ(hairfile_in->GetOffsetsArray(), std::vector<unsigned int>({ 0, 5, 11 }));
+    EXPECT_EQ(hairfile_in->GetPointsArray()[3 * 5], 2.0f);
+    EXPECT_EQ(hairfile_in->GetThicknessArray()[5], hairfile->GetThicknessArray()[4 + 5]);
+    EXPECT_THROW({ io::load_h5_subset("test_io_out_range.h5", {{ 3, 6 }}); }, std::runtime_error);
+}
+
+TEST(io_h5, read_no_points) {
+    auto hairfile = generate_test_data();
+    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_THICKNESS_BIT);
+    io::save_h5("test_io_out_no_points.h5", hairfile);
+    EXPECT_THROW({ io::load_h5("test_io_out_no_points.h5"); }, std::runtime_error);
+}
+
+TEST(io_subset, write) {
+    auto hairfile = generate_test_data();
+    const HairSubset subset(hairfile, std::vector<unsigned int>{ 1, 2, 4 });
+    for (const std::string ext : { "bin", "hair", "data" }) {
+        const std::string filename = "test_io_out_subset." + ext;
+        io::save_subset(filename, ext, subset);
+        auto hairfile_in = globals::supported_ext.at(ext).first(filename);
+        EXPECT_EQ(hairfile_in->GetHeader().hair_count, 3);
+        EXPECT_EQ(hairfile_in->GetOffsetsArray(), std::vector<unsigned int>({ 0, 5, 11, 19 }));
+        EXPECT_EQ(hairfile_in->GetPointsArray()[3 * 11], 4.0f);
+    }
+}
+
+TEST(io_subset, write_uniform_segments) {
+    auto hairfile = generate_test_data();
+    HairSubset subset(hairfile, std::vector<unsigned int>{ 2 });
+    subset.uniform_segments = true;
+    io::save_subset("test_io_out_subset_uniform.hair", "hair", subset);
+    auto hairfile_in = io::load_hair("test_io_out_subset_uniform.hair");
+    EXPECT_FALSE(hairfile_in->GetHeader().arrays & _CY_HAIR_FILE_SEGMENTS_BIT);
+    EXPECT_EQ(hairfile_in->GetHeader().d_segments, 5);
+    EXPECT_EQ(hairfile_in->GetHeader().point_count, 6);
+    EXPECT_EQ(subset.materialize()->GetHeader().d_segments, 5);
+}
+
+TEST(io_subset, read) {
+    for (const bool uniform_segments : { false, true }) {
+        auto hairfile = generate_test_data(uniform_segments);
+        const std::vector<unsigned int>& offsets = hairfile->GetOffsetsArray();
+        for (const std::string ext : { "bin", "hair", "data", "npy", "ply" }) {
+            const std::string filename = "test_io_out_subset_read." + ext;
+            globals::supported_ext.at(ext).second(filename, hairfile);
+            auto hairfile_in = io::load_subset(filename, ext, {{ 1, 3 }, { 4, 5 }});
+            EXPECT_EQ(hairfile_in->GetHeader().hair_count, 3);
+            EXPECT_EQ(hairfile_in->GetHeader().point_count, offsets[3] - offsets[1] + offsets[5] - offsets[4]);
+            EXPECT_TRUE(std::equal(hairfile->GetPointsArray() + 3 * offsets[1], hairfile->GetPointsArray() + 3 * offsets[3], hairfile_in->GetPointsArray()));
+            EXPECT_EQ(hairfile_in->GetPointsArray()[3 * (offsets[3] - offsets[1])], 4.0f);
+            EXPECT_THROW({ io::load_subset(filename, ext, {{ 4, 6 }}); }, std::runtime_error);
+        }
+    }
+}
 
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
 #include "util.h"
+#include "parallel.h"
+#include "strands.h"
+#include "subset.h"
+
+#include <thread>
 
 TEST(util_trim_whitespaces, space) {
     const std::string str_in = "  a b c  ";
@@ -67,3 +72,168 @@ TEST(util_parse_comma_separated_values, float) {
     EXPECT_FLOAT_EQ(values[1], 2.2f);
     EXPECT_FLOAT_EQ(values[2], 3.3f);
 }
+
+TEST(util_match_wildcard, test) {
+    EXPECT_TRUE(util::match_wildcard("Bangs_100.bin", "*.bin"));
+    EXPECT_TRUE(util::match_wildcard("Bangs_100.bin", "Bangs_?00.*"));
+    EXPECT_TRUE(util::match_wildcard("Bangs_100.bin", "*"));
+    EXPECT_FALSE(util::match_wildcard("Bangs_100.bin", "*.ply"));
+    EXPECT_FALSE(util::match_wildcard("Bangs_100.bin", "Bangs_?.bin"));
+}
+
+TEST(util_list_batch_input_files, npy_offsets) {
+    const std::filesystem::path dir = "test_util_out_batch";
+    std::filesystem::create_directories(dir);
+    for (const std::string name : { "a.npy", "a_offsets.npy", "b_offsets.npy" })
+        std::ofstream(dir / name);
+    EXPECT_EQ(util::list_batch_input_files((dir / "*.npy").string()), std::vector<std::string>({ (dir / "a.npy").string(), (dir / "b_offsets.npy").string() }));
+}
+
+TEST(util_parse_strand_ranges, test) {
+    using ranges_t = std::vector<std::pair<unsigned int, unsigned int>>;
+    EXPECT_EQ(util::parse_strand_ranges("1000-2000,5000"), ranges_t({ { 1000, 2001 }, { 5000, 5001 } }));
+    EXPECT_EQ(util::parse_strand_ranges("7, 3-5,4,6"), ranges_t({ { 3, 8 } }));
+    EXPECT_THROW(util::parse_strand_ranges(""), std::runtime_error);
+    EXPECT_THROW(util::parse_strand_ranges("5-3"), std::runtime_error);
+    EXPECT_THROW(util::parse_strand_ranges("1,x"), std::runtime_error);
+}
+
+TEST(parallel_for_range, covers_range_once) {
+    globals::num_threads = 4;
+    std::vector<int> count(1000, 0);
+    parallel::for_range(count.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            ++count[i];
+    });
+    EXPECT_EQ(std::count(count.begin(), count.end(), 1), 1000);
+    globals::num_threads = 0;
+}
+
+TEST(parallel_for_range, rethrow) {
+    globals::num_threads = 4;
+    EXPECT_THROW(parallel::for_range(1000, [](size_t begin, size_t) {
+        if (begin >= 500)
+            throw std::runtime_error("error");
+    }), std::runtime_error);
+    globals::num_threads = 0;
+}
+
+TEST(parallel_for_range, uneven_cost) {
+    globals::num_threads = 4;
+    globals::thread_busy_time = {};
+    std::vector<unsigned int> cost_offsets = { 0 };
+    for (unsigned int i = 0; i < 1000; ++i)
+        cost_offsets.push_back(cost_offsets.back() + (i % 100 == 0 ? 3000 : 10));
+    std::vector<int> count(1000, 0);
+    parallel::for_range(cost_offsets, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            ++count[i];
+    });
+    EXPECT_EQ(std::count(count.begin(), count.end(), 1), 1000);
+    EXPECT_EQ(globals::thread_busy_time.size(), 4);
+    globals::num_threads = 0;
+}
+
+TEST(parallel_for_range, thread_state_busy_time) {
+    // A thread with a state of its own records its busy time there, leaving the process state alone
+    globals::thread_busy_time = {};
+    globals::State state;
+    std::thread thread([&]{
+        globals::use_thread_state(state);
+        parallel::for_range(1000, [](size_t, size_t) {});
+        globals::clear();
+        parallel::for_range(1000, [](size_t, size_t) {});
+    });
+    thread.join();
+    EXPECT_EQ(state.thread_busy_time.size(), 1);
+    EXPECT_TRUE(globals::thread_busy_time.empty());
+}
+
+TEST(random_philox, known_answer) {
+    Philox4x32 rng(0, 0);
+    EXPECT_EQ(rng(), 0x6627e8d5u);
+    EXPECT_EQ(rng(), 0xe169c58du);
+    EXPECT_EQ(rng(), 0xbc57ac4cu);
+    EXPECT_EQ(rng(), 0x9b00dbd8u);
+}
+
+TEST(random_philox, streams) {
+    Philox4x32 rng0(1, 0), rng1(1, 1), rng1_again(1, 1);
+    const uint32_t value1 = rng1();
+    EXPECT_NE(rng0(), value1);
+    EXPECT_EQ(rng1_again(), value1);
+}
+
+TEST(hairfile_offsets, cache) {
+    cyHairFile hairfile;
+    hairfile.SetHairCount(3);
+    hairfile.SetPointCount(9);
+    hairfile.SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT);
+    hairfile.GetSegmentsArray()[0] = 1;
+    hairfile.GetSegmentsArray()[1] = 4;
+    hairfile.GetSegmentsArray()[2] = 1;
+    EXPECT_EQ(hairfile.GetOffsetsArray(), std::vector<unsigned int>({ 0, 2, 7, 9 }));
+
+    // Changing the layout drops the cached offsets
+    hairfile.SetArrays(_CY_HAIR_FILE_POINTS_BIT);
+    hairfile.SetDefaultSegmentCount(2);
+    EXPECT_EQ(hairfile.GetOffsetsArray(), std::vector<unsigned int>({ 0, 3, 6, 9 }));
+}
+
+TEST(hair_subset, materialize) {
+    const std::shared_ptr<cyHairFile> hairfile = std::make_shared<cyHairFile>();
+    hairfile->SetHairCount(3);
+    hairfile->SetPointCount(7);
+    hairfile->SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT | _CY_HAIR_FILE_TRANSPARENCY_BIT);
+    hairfile->GetSegmentsArray()[0] = 1;
+    hairfile->GetSegmentsArray()[1] = 2;
+    hairfile->GetSegmentsArray()[2] = 1;
+    for (int k = 0; k < 7; ++k) {
+        hairfile->GetTransparencyArray()[k] = k;
+        for (int c = 0; c < 3; ++c)
+            hairfile->GetPointsArray()[3*k + c] = 10 * k + c;
+    }
+
+    const HairSubset subset(hairfile, std::vector<unsigned char>{ 0, 1, 1 });
+    EXPECT_EQ(subset.offsets, std::vector<unsigned int>({ 0, 3, 5 }));
+    EXPECT_EQ(subset.base_offset(1), 5);
+
+    const std::shared_ptr<cyHairFile> hairfile_out = subset.materialize();
+    ASSERT_TRUE(hairfile_out);
+    EXPECT_EQ(hairfile_out->GetOffsetsArray(), std::vector<unsigned int>({ 0, 3, 5 }));
+    EXPECT_EQ(hairfile_out->GetSegmentsArray()[0], 2);
+    EXPECT_EQ(hairfile_out->GetPointsArray()[0], 20.0f);
+    EXPECT_EQ(hairfile_out->GetPointsArray()[3*4 + 2], 62.0f);
+    EXPECT_EQ(hairfile_out->GetTransparencyArray()[3], 5.0f);
+}
+
+TEST(strands, round_trip) {
+    // Two strands: an L shape (right angle at the middle point) and a single segment
+    cyHairFile hairfile;
+    hairfile.SetHairCount(2);
+    hairfile.SetPointCount(5);
+    hairfile.SetArrays(_CY_HAIR_FILE_SEGMENTS_BIT | _CY_HAIR_FILE_POINTS_BIT | _CY_HAIR_FILE_THICKNESS_BIT);
+    const std::vector<float> points = { 0,0,0, 1,0,0, 1,2,0, 5,5,5, 5,5,8 };
+    std::copy(points.begin(), points.end(), hairfile.GetPointsArray());
+    hairfile.GetSegmentsArray()[0] = 2;
+    hairfile.GetSegmentsArray()[1] = 1;
+    for (int k = 0; k < 5; ++k)
+        hairfile.GetThicknessArray()[k] = 0.1f * k;
+
+    const Strands strands(hairfile);
+    EXPECT_EQ(strands.offsets, std::vector<unsigned int>({ 0, 3, 5 }));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(strands.x.data()) % 64, 0);
+    EXPECT_EQ(strands.y[2], 2.0f);
+    EXPECT_TRUE(strands.transparency.empty());
+
+    const aligned_vector<float> segment_lengths = strands.segment_lengths();
+    EXPECT_EQ(std::vector<float>(segment_lengths.begin(), segment_lengths.end()), std::vector<float>({ 1, 2, 0, 3, 0 }));
+    const Strands::Wedges wedges = strands.wedges(segment_lengths);
+    EXPECT_NEAR(wedges.turning_angle[1], 90.0f, 1e-4f);
+    EXPECT_EQ(wedges.turning_angle[3], 0.0f);
+
+    const std::shared_ptr<cyHairFile> hairfile_out = strands.to_hairfile();
+    EXPECT_EQ(hairfile_out->GetHeader().arrays, hairfile.GetHeader().arrays);
+    EXPECT_TRUE(std::equal(points.begin(), points.end(), hairfile_out->GetPointsArray()));
+    EXPECT_TRUE(std::equal(hairfile.GetThicknessArray(), hairfile.GetThicknessArray() + 5, hairfile_out->GetThicknessArray()));
+}